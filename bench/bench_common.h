@@ -0,0 +1,138 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+//Shared fixture for the host JVM benchmarks in this directory.
+//
+//Build against a desktop JDK, e.g.:
+//  javac -d bench/classes bench/java/safejni/bench/*.java
+//  g++ -O2 -std=c++14 -I. -I$JAVA_HOME/include -I$JAVA_HOME/include/linux
+//      bench/bench_scalability.cpp safejni.cpp safejni_stats.cpp safejni_cputime.cpp
+//      safejni_slowcall.cpp safejni_resolution.cpp safejni_adaptive.cpp safejni_critical.cpp
+//      -L$JAVA_HOME/lib/server -ljvm -ldl -pthread -o bench_scalability
+//  LD_LIBRARY_PATH=$JAVA_HOME/lib/server ./bench_scalability --threads=1,2,4,8,16,32,64
+//bench_conversion also links safejni_parallel.cpp.
+//
+//The classpath defaults to bench/classes and can be changed with SAFEJNI_BENCH_CLASSPATH.
+
+#pragma once
+
+#include "safejni.h"
+#include "safejni_histogram.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+
+namespace safejni {
+namespace bench {
+
+
+//An embedded JVM for the lifetime of the benchmark, safejni is initialised against it.
+class HostJvm {
+public:
+  explicit HostJvm(const std::vector<std::string> &extraOptions = std::vector<std::string>()) {
+    const char *classPath = getenv("SAFEJNI_BENCH_CLASSPATH");
+    std::vector<std::string> options;
+    options.push_back(std::string("-Djava.class.path=") + (classPath ? classPath : "bench/classes"));
+    options.insert(options.end(), extraOptions.begin(), extraOptions.end());
+
+    std::vector<JavaVMOption> jvmOptions(options.size());
+    for (size_t i = 0; i < options.size(); ++i) {
+      jvmOptions[i].optionString = const_cast<char *>(options[i].c_str());
+      jvmOptions[i].extraInfo = nullptr;
+    }
+    JavaVMInitArgs args;
+    args.version = JNI_VERSION_1_8;
+    args.nOptions = static_cast<jint>(jvmOptions.size());
+    args.options = jvmOptions.data();
+    args.ignoreUnrecognized = JNI_FALSE;
+    uint64_t start = LatencyHistogram::nowNanos();
+    if (JNI_CreateJavaVM(&vm, reinterpret_cast<void **>(&env), &args) != JNI_OK) {
+      fprintf(stderr, "could not create the JVM\n");
+      exit(1);
+    }
+    uint64_t created = LatencyHistogram::nowNanos();
+    safejni::init(vm, env);
+    createNanos = created - start;
+    initNanos = LatencyHistogram::nowNanos() - created;
+  }
+
+  ~HostJvm() {
+    vm->DestroyJavaVM();
+  }
+
+  JavaVM *vm = nullptr;
+  JNIEnv *env = nullptr;
+  //JNI_CreateJavaVM and safejni::init, for the startup benchmark
+  uint64_t createNanos = 0;
+  uint64_t initNanos = 0;
+};
+
+//--name=value lookup with a default
+inline std::string option(int argc, char **argv, const std::string &name, const std::string &fallback) {
+  std::string prefix = "--" + name + "=";
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.compare(0, prefix.size(), prefix) == 0) {
+      return arg.substr(prefix.size());
+    }
+  }
+  return fallback;
+}
+
+inline std::vector<std::string> split(const std::string &value, char separator = ',') {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (start <= value.size()) {
+    size_t end = value.find(separator, start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    if (end > start) {
+      parts.push_back(value.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return parts;
+}
+
+//"64", "4K", "16M" (powers of ten, so 100M is a hundred million)
+inline size_t parseCount(const std::string &value) {
+  size_t count = static_cast<size_t>(atoll(value.c_str()));
+  switch (value.empty() ? '\0' : value.back()) {
+    case 'K':
+    case 'k':
+      return count * 1000;
+    case 'M':
+    case 'm':
+      return count * 1000 * 1000;
+    case 'G':
+    case 'g':
+      return count * 1000 * 1000 * 1000;
+    default:
+      return count;
+  }
+}
+
+inline void printLatencyHeader() {
+  printf("%-22s %8s %14s %10s %10s %10s %10s %10s\n", "case", "threads", "ops/s", "mean(ns)",
+         "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)");
+}
+
+inline void printLatencyRow(const std::string &name, int threads, double opsPerSecond,
+                            const LatencyHistogram &histogram) {
+  printf("%-22s %8d %14.0f %10.0f %10llu %10llu %10llu %10llu\n", name.c_str(), threads, opsPerSecond,
+         histogram.mean(), (unsigned long long) histogram.percentile(50),
+         (unsigned long long) histogram.percentile(99), (unsigned long long) histogram.percentile(99.9),
+         (unsigned long long) histogram.max());
+  fflush(stdout);
+}
+
+
+}
+}
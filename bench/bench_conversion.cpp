@@ -0,0 +1,245 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+//Throughput matrix of the conversors, both directions, swept over element counts. Each cell
+//repeats the conversion for at least --min-ms and reports ns per element and MB/s of payload
+//(UTF-8 bytes for strings, raw bytes for arrays). Cells whose estimated footprint (payload plus
+//per-element object overhead on both sides) is over --max-mb are skipped.
+//  --sizes=0,1,10,100,1K,10K,100K,1M,10M,100M  --min-ms=200  --max-mb=2048
+//  --case=ascii,cjk,emoji,bytes,parbytes,floats,strings,map  --direction=to,from
+//parbytes is bytes through a ParallelArrayCopier forced onto its parallel path, the rows where
+//it beats bytes give the crossover that ParallelArrayCopier::calibrate() should settle on.
+
+#include "bench_common.h"
+#include "safejni_parallel.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <new>
+
+using namespace safejni;
+using namespace safejni::bench;
+
+namespace {
+
+struct Cell {
+  //payload bytes moved by one conversion
+  size_t bytes;
+  std::function<void(JNIEnv *env)> run;
+};
+
+struct Case {
+  std::string name;
+  //bytes of payload per element, used to skip oversized cells before building them
+  size_t bytesPerElement;
+  //rough per-element cost of the objects holding that payload (C++ strings and nodes, java
+  //String/byte[] headers, HashMap nodes), input and converted copy together
+  size_t overheadPerElement = 0;
+  //builds the C++ -> java and java -> C++ cells for n elements, an empty run means unsupported
+  std::function<Cell(JNIEnv *env, size_t n)> to;
+  std::function<Cell(JNIEnv *env, size_t n)> from;
+};
+
+std::string repeat(const std::string &unit, size_t n) {
+  std::string text;
+  text.reserve(unit.size() * n);
+  for (size_t i = 0; i < n; ++i) {
+    text += unit;
+  }
+  return text;
+}
+
+//java side input kept alive for the whole cell
+jobject global(JNIEnv *env, jobject local) {
+  jobject ref = env->NewGlobalRef(local);
+  env->DeleteLocalRef(local);
+  return ref;
+}
+
+Case stringCase(const std::string &name, const std::string &unit) {
+  Case c;
+  c.name = name;
+  c.bytesPerElement = unit.size();
+  c.to = [unit](JNIEnv *, size_t n) {
+    auto text = std::make_shared<std::string>(repeat(unit, n));
+    return Cell{text->size(), [text](JNIEnv *env) { Tools::toJString(env, *text); }};
+  };
+  c.from = [unit](JNIEnv *env, size_t n) {
+    std::string text = repeat(unit, n);
+    auto ref = std::shared_ptr<_jobject>(global(env, Tools::toJString(env, text)), [](jobject o) {
+      Tools::attachJniEnv()->DeleteGlobalRef(o);
+    });
+    return Cell{text.size(), [ref](JNIEnv *env) { Tools::toString(env, static_cast<jstring>(ref.get())); }};
+  };
+  return c;
+}
+
+std::vector<Case> buildCases() {
+  std::vector<Case> cases;
+  cases.push_back(stringCase("ascii", "a"));
+  cases.push_back(stringCase("cjk", "\xe4\xb8\xad"));
+  //standard UTF-8, not the modified UTF-8 of NewStringUTF: shows what callers passing it pay
+  cases.push_back(stringCase("emoji", "\xf0\x9f\x98\x80"));
+
+  Case bytes;
+  bytes.name = "bytes";
+  bytes.bytesPerElement = 1;
+  bytes.to = [](JNIEnv *, size_t n) {
+    auto data = std::make_shared<std::vector<uint8_t>>(n, 7);
+    return Cell{n, [data](JNIEnv *env) { Tools::toJObjectArray(env, *data); }};
+  };
+  bytes.from = [](JNIEnv *env, size_t n) {
+    auto ref = std::shared_ptr<_jobject>(global(env, env->NewByteArray(static_cast<jsize>(n))),
+                                         [](jobject o) { Tools::attachJniEnv()->DeleteGlobalRef(o); });
+    return Cell{n, [ref](JNIEnv *env) { Tools::toVectorByte(env, static_cast<jbyteArray>(ref.get())); }};
+  };
+  cases.push_back(bytes);
+
+  auto copier = std::make_shared<ParallelArrayCopier>();
+  copier->setParallelThreshold(0);
+  Case parbytes;
+  parbytes.name = "parbytes";
+  parbytes.bytesPerElement = 1;
+  parbytes.to = [copier](JNIEnv *, size_t n) {
+    auto data = std::make_shared<std::vector<uint8_t>>(n, 7);
+    return Cell{n, [copier, data](JNIEnv *env) { copier->toJByteArray(env, *data); }};
+  };
+  parbytes.from = [copier](JNIEnv *env, size_t n) {
+    auto ref = std::shared_ptr<_jobject>(global(env, env->NewByteArray(static_cast<jsize>(n))),
+                                         [](jobject o) { Tools::attachJniEnv()->DeleteGlobalRef(o); });
+    return Cell{n, [copier, ref](JNIEnv *env) {
+      copier->toVectorByte(env, static_cast<jbyteArray>(ref.get()));
+    }};
+  };
+  cases.push_back(parbytes);
+
+  Case floats;
+  floats.name = "floats";
+  floats.bytesPerElement = sizeof(float);
+  floats.to = [](JNIEnv *, size_t n) {
+    //no C++ -> java float conversor, this is the array region path callers use instead
+    auto data = std::make_shared<std::vector<float>>(n, 1.5f);
+    return Cell{n * sizeof(float), [data](JNIEnv *env) {
+      jfloatArray array = env->NewFloatArray(static_cast<jsize>(data->size()));
+      fill(env, array, data->data(), static_cast<jsize>(data->size()));
+    }};
+  };
+  floats.from = [](JNIEnv *env, size_t n) {
+    auto ref = std::shared_ptr<_jobject>(global(env, env->NewFloatArray(static_cast<jsize>(n))),
+                                         [](jobject o) { Tools::attachJniEnv()->DeleteGlobalRef(o); });
+    return Cell{n * sizeof(float), [ref](JNIEnv *env) {
+      Tools::toVectorFloat(env, static_cast<jfloatArray>(ref.get()));
+    }};
+  };
+  cases.push_back(floats);
+
+  Case strings;
+  strings.name = "strings";
+  strings.bytesPerElement = 16;
+  //std::string heap block + String + byte[], each of them twice
+  strings.overheadPerElement = 2 * (32 + 24 + 16);
+  strings.to = [](JNIEnv *, size_t n) {
+    auto data = std::make_shared<std::vector<std::string>>(n, std::string(16, 's'));
+    return Cell{n * 16, [data](JNIEnv *env) { Tools::toJObjectArray(env, *data); }};
+  };
+  strings.from = [](JNIEnv *env, size_t n) {
+    auto ref = std::shared_ptr<_jobject>(global(env, Tools::toJObjectArray(env, std::vector<std::string>(
+            n, std::string(16, 's')))), [](jobject o) { Tools::attachJniEnv()->DeleteGlobalRef(o); });
+    return Cell{n * 16, [ref](JNIEnv *env) {
+      Tools::toVectorString(env, static_cast<jobjectArray>(ref.get()));
+    }};
+  };
+  cases.push_back(strings);
+
+  Case map;
+  map.name = "map";
+  map.bytesPerElement = 24;
+  //std::map node with two std::strings, HashMap.Node + table slot + two String/byte[] pairs
+  map.overheadPerElement = 96 + 40 + 2 * (24 + 16);
+  map.to = [](JNIEnv *, size_t n) {
+    auto data = std::make_shared<std::map<std::string, std::string>>();
+    char key[32];
+    for (size_t i = 0; i < n; ++i) {
+      snprintf(key, sizeof(key), "key%012zu", i);
+      (*data)[key] = "value123";
+    }
+    return Cell{n * 24, [data](JNIEnv *env) { Tools::toHashMap(env, *data); }};
+  };
+  //there is no HashMap -> std::map conversor
+  map.from = nullptr;
+  cases.push_back(map);
+  return cases;
+}
+
+void runCell(const std::string &name, const char *direction, size_t n, const Cell &cell,
+             double minSeconds) {
+  JNIEnv *env = Tools::attachJniEnv();
+  //one untimed pass so class loading and first resolution stay out of the numbers
+  env->PushLocalFrame(16);
+  cell.run(env);
+  env->PopLocalFrame(nullptr);
+
+  uint64_t iterations = 0;
+  uint64_t start = LatencyHistogram::nowNanos();
+  uint64_t elapsed = 0;
+  do {
+    env->PushLocalFrame(16);
+    cell.run(env);
+    env->PopLocalFrame(nullptr);
+    iterations++;
+    elapsed = LatencyHistogram::nowNanos() - start;
+  } while (elapsed < minSeconds * 1e9);
+
+  double perIteration = static_cast<double>(elapsed) / iterations;
+  printf("%-8s %-5s %12zu %14zu %10llu %12.2f %12.1f\n", name.c_str(), direction, n, cell.bytes,
+         (unsigned long long) iterations, n ? perIteration / n : perIteration,
+         cell.bytes ? cell.bytes / (perIteration / 1e9) / (1024.0 * 1024.0) : 0.0);
+  fflush(stdout);
+}
+
+}
+
+int main(int argc, char **argv) {
+  HostJvm jvm;
+  std::vector<std::string> sizes = split(option(argc, argv, "sizes", "0,1,10,100,1K,10K,100K,1M,10M,100M"));
+  double minSeconds = atof(option(argc, argv, "min-ms", "200").c_str()) / 1000;
+  size_t maxBytes = parseCount(option(argc, argv, "max-mb", "2048")) * 1024 * 1024;
+  std::vector<std::string> selected = split(
+          option(argc, argv, "case", "ascii,cjk,emoji,bytes,parbytes,floats,strings,map"));
+  std::vector<std::string> directions = split(option(argc, argv, "direction", "to,from"));
+  bool to = std::find(directions.begin(), directions.end(), "to") != directions.end();
+  bool from = std::find(directions.begin(), directions.end(), "from") != directions.end();
+
+  printf("%-8s %-5s %12s %14s %10s %12s %12s\n", "case", "dir", "elements", "bytes", "iters",
+         "ns/element", "MB/s");
+  for (const Case &c : buildCases()) {
+    if (std::find(selected.begin(), selected.end(), c.name) == selected.end()) {
+      continue;
+    }
+    for (const std::string &size : sizes) {
+      size_t n = parseCount(size);
+      if (n * (c.bytesPerElement + c.overheadPerElement) > maxBytes) {
+        printf("%-8s %-5s %12zu skipped, over --max-mb\n", c.name.c_str(), "", n);
+        continue;
+      }
+      //large cells can exhaust the java or the native heap, that only ends the cell
+      try {
+        if (to) {
+          runCell(c.name, "to", n, c.to(jvm.env, n), minSeconds);
+        }
+        if (from && c.from) {
+          runCell(c.name, "from", n, c.from(jvm.env, n), minSeconds);
+        }
+      } catch (const JNIException &e) {
+        printf("%-8s %-5s %12zu failed: %s\n", c.name.c_str(), "", n, e.what());
+      } catch (const std::bad_alloc &) {
+        printf("%-8s %-5s %12zu failed: out of native memory\n", c.name.c_str(), "", n);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+//Tail latency of safejni call paths while a java thread churns the heap. GC pauses reported by
+//the collector notifications are lined up with the slow samples, so paths that stall on
+//safepoints or critical sections stand out.
+//  --seconds=5  --alloc-kb-per-ms=512  --retained-mb=64  --slow-us=500  --histogram=0
+//  --threads=1  --payload=65536  --api=callstatic,toVectorByte,critical,toString,newObject
+
+#include "bench_common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+using namespace safejni;
+using namespace safejni::bench;
+
+namespace {
+
+struct Api {
+  std::string name;
+  std::function<void()> run;
+};
+
+struct SlowSample {
+  uint64_t start;
+  uint64_t latency;
+};
+
+struct GcWindow {
+  uint64_t start;
+  uint64_t end;
+};
+
+std::vector<GcWindow> drainGcWindows() {
+  JNIEnv *env = Tools::attachJniEnv();
+  JNIObjectPtr events = CallStatic<JNIObjectPtr>("safejni/bench/GcPressure", "drainEvents", "()[J");
+  std::vector<GcWindow> windows;
+  jlongArray array = static_cast<jlongArray>(events->instance);
+  jsize length = env->GetArrayLength(array);
+  std::vector<jlong> values(length);
+  if (length) {
+    env->GetLongArrayRegion(array, 0, length, values.data());
+  }
+  for (jsize i = 0; i + 1 < length; i += 2) {
+    windows.push_back({static_cast<uint64_t>(values[i]), static_cast<uint64_t>(values[i + 1])});
+  }
+  return windows;
+}
+
+void runApi(const Api &api, int threads, double seconds, uint64_t slowNanos, bool dumpHistogram) {
+  std::atomic<bool> stop(false);
+  std::vector<std::unique_ptr<LatencyHistogram>> histograms;
+  std::vector<std::vector<SlowSample>> slow(threads);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    histograms.emplace_back(new LatencyHistogram());
+  }
+  drainGcWindows();
+  uint64_t begin = LatencyHistogram::nowNanos();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      JNIEnv *env = Tools::attachJniEnv();
+      while (!stop.load(std::memory_order_relaxed)) {
+        env->PushLocalFrame(16);
+        uint64_t start = LatencyHistogram::nowNanos();
+        api.run();
+        uint64_t latency = LatencyHistogram::nowNanos() - start;
+        env->PopLocalFrame(nullptr);
+        histograms[t]->record(latency);
+        if (latency >= slowNanos) {
+          slow[t].push_back({start, latency});
+        }
+      }
+      Tools::detachJniEnv();
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  double elapsed = (LatencyHistogram::nowNanos() - begin) / 1e9;
+  std::vector<GcWindow> gcs = drainGcWindows();
+
+  LatencyHistogram merged;
+  for (auto &histogram : histograms) {
+    merged.merge(*histogram);
+  }
+  size_t slowTotal = 0;
+  size_t slowDuringGc = 0;
+  for (auto &samples : slow) {
+    for (const SlowSample &sample : samples) {
+      slowTotal++;
+      uint64_t end = sample.start + sample.latency;
+      for (const GcWindow &gc : gcs) {
+        if (sample.start < gc.end && end > gc.start) {
+          slowDuringGc++;
+          break;
+        }
+      }
+    }
+  }
+  uint64_t gcNanos = 0;
+  for (const GcWindow &gc : gcs) {
+    gcNanos += gc.end - gc.start;
+  }
+
+  printf("%-14s ops/s %.0f  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  p99.99 %llu  max %llu ns\n",
+         api.name.c_str(), merged.count() / elapsed,
+         (unsigned long long) merged.percentile(50), (unsigned long long) merged.percentile(90),
+         (unsigned long long) merged.percentile(99), (unsigned long long) merged.percentile(99.9),
+         (unsigned long long) merged.percentile(99.99), (unsigned long long) merged.max());
+  printf("%-14s gc pauses %zu (%.1f ms total), slow samples %zu, of which during gc %zu\n",
+         "", gcs.size(), gcNanos / 1e6, slowTotal, slowDuringGc);
+  if (dumpHistogram) {
+    for (int i = 0; i < LatencyHistogram::kBuckets; ++i) {
+      if (merged.bucketCount(i)) {
+        printf("  <= %llu ns: %llu\n", (unsigned long long) LatencyHistogram::bucketUpperBound(i),
+               (unsigned long long) merged.bucketCount(i));
+      }
+    }
+  }
+  fflush(stdout);
+}
+
+}
+
+int main(int argc, char **argv) {
+  HostJvm jvm;
+  double seconds = atof(option(argc, argv, "seconds", "5").c_str());
+  int allocKbPerMs = atoi(option(argc, argv, "alloc-kb-per-ms", "512").c_str());
+  int retainedMb = atoi(option(argc, argv, "retained-mb", "64").c_str());
+  uint64_t slowNanos = static_cast<uint64_t>(atof(option(argc, argv, "slow-us", "500").c_str()) * 1000);
+  bool dumpHistogram = atoi(option(argc, argv, "histogram", "0").c_str()) != 0;
+  int threads = atoi(option(argc, argv, "threads", "1").c_str());
+  size_t payload = static_cast<size_t>(atol(option(argc, argv, "payload", "65536").c_str()));
+  std::vector<std::string> selected = split(
+          option(argc, argv, "api", "callstatic,toVectorByte,critical,toString,newObject"));
+
+  JNIEnv *env = jvm.env;
+  jbyteArray localBytes = env->NewByteArray(static_cast<jsize>(payload));
+  jbyteArray bytes = static_cast<jbyteArray>(env->NewGlobalRef(localBytes));
+  jstring localText = Tools::toJString(env, std::string(256, 'x'));
+  jstring text = static_cast<jstring>(env->NewGlobalRef(localText));
+  env->DeleteLocalRef(localBytes);
+  env->DeleteLocalRef(localText);
+
+  std::vector<Api> apis;
+  apis.push_back({"callstatic", [] {
+    CallStatic<int32_t>("safejni/bench/Fixture", "staticAdd", "(II)I", 1, 2);
+  }});
+  apis.push_back({"toVectorByte", [bytes] {
+    Tools::toVectorByte(Tools::attachJniEnv(), bytes);
+  }});
+  apis.push_back({"critical", [bytes, payload] {
+    //pinned view: the same bytes read through GetPrimitiveArrayCritical
+    thread_local std::vector<jbyte> buffer;
+    buffer.resize(payload);
+    readInto(Tools::attachJniEnv(), buffer.data(), bytes, static_cast<jsize>(payload), 0,
+             ArrayTransfer::Critical);
+  }});
+  apis.push_back({"toString", [text] {
+    Tools::toString(Tools::attachJniEnv(), text);
+  }});
+  apis.push_back({"newObject", [] {
+    JNIObject::NewObject("safejni/bench/Fixture", "()V");
+  }});
+
+  printf("gc pressure: %d KB/ms, %d MB retained, %d thread(s), %.1fs per api\n",
+         allocKbPerMs, retainedMb, threads, seconds);
+  CallStatic<void>("safejni/bench/GcPressure", "start", "(II)V", allocKbPerMs * 1024, retainedMb);
+  for (const Api &api : apis) {
+    if (std::find(selected.begin(), selected.end(), api.name) != selected.end()) {
+      runApi(api, threads, seconds, slowNanos, dumpHistogram);
+    }
+  }
+  CallStatic<void>("safejni/bench/GcPressure", "stop", "()V");
+
+  env->DeleteGlobalRef(bytes);
+  env->DeleteGlobalRef(text);
+  return 0;
+}
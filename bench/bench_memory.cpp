@@ -0,0 +1,229 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+//Native memory footprint of the wrappers, method infos and conversion results. operator new
+//is replaced in this binary to count calls and bytes; mallinfo2 adds what the JVM itself
+//mallocs (JNI handle blocks for global refs) and /proc/self/statm the resident growth.
+//Retained cases keep every result alive, so the per-op numbers size memory budgets.
+//  --count=100000  --ops=createGlobal,newObject,methodInfo,toString,toVectorByte,toVectorString,cache
+
+#include "bench_common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <malloc.h>
+#include <new>
+#include <unistd.h>
+
+using namespace safejni;
+using namespace safejni::bench;
+
+namespace {
+
+std::atomic<uint64_t> totalNewCalls(0);
+std::atomic<uint64_t> totalNewBytes(0);
+std::atomic<int64_t> totalLiveBytes(0);
+
+void *countedAlloc(size_t size) {
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  totalNewCalls.fetch_add(1, std::memory_order_relaxed);
+  totalNewBytes.fetch_add(size, std::memory_order_relaxed);
+  totalLiveBytes.fetch_add(static_cast<int64_t>(malloc_usable_size(p)), std::memory_order_relaxed);
+  return p;
+}
+
+void countedFree(void *p) {
+  if (p) {
+    totalLiveBytes.fetch_sub(static_cast<int64_t>(malloc_usable_size(p)), std::memory_order_relaxed);
+    free(p);
+  }
+}
+
+}
+
+void *operator new(size_t size) { return countedAlloc(size); }
+
+void *operator new[](size_t size) { return countedAlloc(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return countedAlloc(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return countedAlloc(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void *p) noexcept { countedFree(p); }
+
+void operator delete[](void *p) noexcept { countedFree(p); }
+
+void operator delete(void *p, size_t) noexcept { countedFree(p); }
+
+void operator delete[](void *p, size_t) noexcept { countedFree(p); }
+
+namespace {
+
+struct Footprint {
+  uint64_t newCalls;
+  uint64_t newBytes;
+  int64_t liveBytes;
+  int64_t mallocBytes;
+  int64_t residentBytes;
+
+  static Footprint now() {
+    Footprint f;
+    f.newCalls = totalNewCalls.load();
+    f.newBytes = totalNewBytes.load();
+    f.liveBytes = totalLiveBytes.load();
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    f.mallocBytes = static_cast<int64_t>(mallinfo2().uordblks);
+#else
+    f.mallocBytes = static_cast<int64_t>(mallinfo().uordblks);
+#endif
+    f.residentBytes = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+      long size = 0, resident = 0;
+      if (fscanf(statm, "%ld %ld", &size, &resident) == 2) {
+        f.residentBytes = static_cast<int64_t>(resident) * sysconf(_SC_PAGESIZE);
+      }
+      fclose(statm);
+    }
+    return f;
+  }
+};
+
+struct Op {
+  std::string name;
+  //runs once per iteration, retained results are kept in the op until release
+  std::function<void(JNIEnv *env, size_t i)> run;
+  std::function<void()> release;
+  //sizes the retaining container up front so its growth stays out of the per-op numbers
+  std::function<void(size_t count)> reserve;
+};
+
+void measure(const Op &op, size_t count) {
+  JNIEnv *env = Tools::attachJniEnv();
+  if (op.reserve) {
+    op.reserve(count);
+  }
+  Footprint before = Footprint::now();
+  for (size_t i = 0; i < count; ++i) {
+    env->PushLocalFrame(16);
+    op.run(env, i);
+    env->PopLocalFrame(nullptr);
+  }
+  Footprint after = Footprint::now();
+  double n = static_cast<double>(count);
+  printf("%-16s %10zu %10.2f %12.1f %12.1f %12.1f %12.1f\n", op.name.c_str(), count,
+         (after.newCalls - before.newCalls) / n, (after.newBytes - before.newBytes) / n,
+         (after.liveBytes - before.liveBytes) / n, (after.mallocBytes - before.mallocBytes) / n,
+         (after.residentBytes - before.residentBytes) / n);
+  fflush(stdout);
+  if (op.release) {
+    op.release();
+  }
+}
+
+std::vector<Op> buildOps(JNIEnv *env) {
+  std::vector<Op> ops;
+  auto objects = std::make_shared<std::vector<JNIObjectPtr>>();
+  auto release = [objects] { objects->clear(); objects->shrink_to_fit(); };
+  auto reserve = [objects](size_t count) { objects->reserve(count); };
+
+  JNIObjectPtr fixture = JNIObject::NewObject("safejni/bench/Fixture", "()V");
+  ops.push_back({"createGlobal", [objects, fixture](JNIEnv *, size_t) {
+    objects->push_back(JNIObject::CreateGlobal(fixture->instance));
+  }, release, reserve});
+  ops.push_back({"newObject", [objects](JNIEnv *, size_t) {
+    objects->push_back(JNIObject::NewObject("safejni/bench/Fixture", "()V"));
+  }, release, reserve});
+  //transient: what every Call pays for its SPJNIMethodInfo
+  ops.push_back({"methodInfo", [](JNIEnv *env, size_t) {
+    Tools::getMethodInfo(env, "safejni/bench/Fixture", "add", "(I)I");
+  }, nullptr, nullptr});
+
+  jstring localText = Tools::toJString(env, std::string(64, 't'));
+  auto text = std::shared_ptr<_jobject>(env->NewGlobalRef(localText), [](jobject o) {
+    Tools::attachJniEnv()->DeleteGlobalRef(o);
+  });
+  env->DeleteLocalRef(localText);
+  auto strings = std::make_shared<std::vector<std::string>>();
+  ops.push_back({"toString", [strings, text](JNIEnv *env, size_t) {
+    strings->push_back(Tools::toString(env, static_cast<jstring>(text.get())));
+  }, [strings] { strings->clear(); strings->shrink_to_fit(); },
+     [strings](size_t count) { strings->reserve(count); }});
+
+  jbyteArray localBytes = env->NewByteArray(1024);
+  auto bytes = std::shared_ptr<_jobject>(env->NewGlobalRef(localBytes), [](jobject o) {
+    Tools::attachJniEnv()->DeleteGlobalRef(o);
+  });
+  env->DeleteLocalRef(localBytes);
+  auto buffers = std::make_shared<std::vector<std::vector<uint8_t>>>();
+  ops.push_back({"toVectorByte", [buffers, bytes](JNIEnv *env, size_t) {
+    buffers->push_back(Tools::toVectorByte(env, static_cast<jbyteArray>(bytes.get())));
+  }, [buffers] { buffers->clear(); buffers->shrink_to_fit(); },
+     [buffers](size_t count) { buffers->reserve(count); }});
+
+  jobjectArray localArray = Tools::toJObjectArray(env, std::vector<std::string>(16, std::string(16, 's')));
+  auto array = std::shared_ptr<_jobject>(env->NewGlobalRef(localArray), [](jobject o) {
+    Tools::attachJniEnv()->DeleteGlobalRef(o);
+  });
+  env->DeleteLocalRef(localArray);
+  auto lists = std::make_shared<std::vector<std::vector<std::string>>>();
+  ops.push_back({"toVectorString", [lists, array](JNIEnv *env, size_t) {
+    lists->push_back(Tools::toVectorString(env, static_cast<jobjectArray>(array.get())));
+  }, [lists] { lists->clear(); lists->shrink_to_fit(); },
+     [lists](size_t count) { lists->reserve(count); }});
+
+  //what a resolution cache would hold per entry: a global class ref and a method info
+  auto cache = std::make_shared<std::vector<SPJNIMethodInfo>>();
+  ops.push_back({"cache", [cache](JNIEnv *env, size_t) {
+    jclass local = env->FindClass("safejni/bench/Fixture");
+    jclass global = static_cast<jclass>(env->NewGlobalRef(local));
+    cache->push_back(std::make_shared<JNIMethodInfo>(global, env->GetMethodID(global, "add", "(I)I"), true));
+  }, [cache] {
+    JNIEnv *env = Tools::attachJniEnv();
+    for (const SPJNIMethodInfo &info : *cache) {
+      env->DeleteGlobalRef(info->classId);
+    }
+    cache->clear();
+    cache->shrink_to_fit();
+  }, [cache](size_t count) { cache->reserve(count); }});
+  return ops;
+}
+
+}
+
+int main(int argc, char **argv) {
+  HostJvm jvm;
+  size_t count = parseCount(option(argc, argv, "count", "100000"));
+  std::vector<std::string> selected = split(option(argc, argv, "ops",
+          "createGlobal,newObject,methodInfo,toString,toVectorByte,toVectorString,cache"));
+
+  printf("sizeof JNIObject %zu, JNIMethodInfo %zu, shared_ptr %zu\n", sizeof(JNIObject),
+         sizeof(JNIMethodInfo), sizeof(JNIObjectPtr));
+  printf("%-16s %10s %10s %12s %12s %12s %12s\n", "op", "count", "new/op", "bytes/op",
+         "live/op", "malloc/op", "rss/op");
+  for (const Op &op : buildOps(jvm.env)) {
+    if (std::find(selected.begin(), selected.end(), op.name) != selected.end()) {
+      measure(op, count);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+//Multi-thread scalability of the safejni call paths: every thread runs the same call mix
+//against a shared embedded JVM for a fixed time, per-call latencies are merged at the end.
+//Each row is followed by the attach and lookup counters bumped inside the measured window,
+//which show whether the env and method caches hold up under contention.
+//  --threads=1,2,4,8,16,32,64  --seconds=2  --mix=attach,static,instance,field,string,bytes,mixed
+
+#include "bench_common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+using namespace safejni;
+using namespace safejni::bench;
+
+namespace {
+
+typedef std::function<void(int iteration)> Operation;
+
+struct Mix {
+  std::string name;
+  //builds the per-thread operation (thread local state such as a fixture instance lives in it)
+  std::function<Operation()> factory;
+};
+
+std::vector<Mix> buildMixes() {
+  std::vector<Mix> mixes;
+  mixes.push_back({"attach", [] {
+    return [](int) { Tools::attachJniEnv(); };
+  }});
+  mixes.push_back({"static", [] {
+    return [](int i) {
+      CallStatic<int32_t>("safejni/bench/Fixture", "staticAdd", "(II)I", i, 1);
+    };
+  }});
+  mixes.push_back({"instance", [] {
+    auto fixture = JNIObject::NewObject("safejni/bench/Fixture", "()V");
+    return [fixture](int) { fixture->SetMemberSignature("(I)I")->Call<int32_t>("add", 1); };
+  }});
+  mixes.push_back({"field", [] {
+    auto fixture = JNIObject::NewObject("safejni/bench/Fixture", "()V");
+    return [fixture](int) { fixture->Get<int32_t>("counter"); };
+  }});
+  mixes.push_back({"string", [] {
+    return [](int) {
+      CallStatic<std::string>("safejni/bench/Fixture", "echo", "(Ljava/lang/String;)Ljava/lang/String;",
+                              std::string("scalability benchmark payload"));
+    };
+  }});
+  mixes.push_back({"bytes", [] {
+    auto payload = std::make_shared<std::vector<uint8_t>>(4096, 7);
+    return [payload](int) {
+      CallStatic<std::vector<uint8_t>>("safejni/bench/Fixture", "echoBytes", "([B)[B", *payload);
+    };
+  }});
+  mixes.push_back({"mixed", [] {
+    auto fixture = JNIObject::NewObject("safejni/bench/Fixture", "()V");
+    return [fixture](int i) {
+      switch (i & 3) {
+        case 0:
+          CallStatic<int32_t>("safejni/bench/Fixture", "staticAdd", "(II)I", i, 1);
+          break;
+        case 1:
+          fixture->SetMemberSignature("(I)I")->Call<int32_t>("add", 1);
+          break;
+        case 2:
+          fixture->Get<int32_t>("counter");
+          break;
+        default:
+          CallStatic<std::string>("safejni/bench/Fixture", "echo",
+                                  "(Ljava/lang/String;)Ljava/lang/String;", std::string("mixed"));
+          break;
+      }
+    };
+  }});
+  return mixes;
+}
+
+//cache contention counters from StatsRegistry
+struct CacheCounters {
+  int64_t attaches;
+  int64_t methodLookups;
+  int64_t fieldLookups;
+
+  static CacheCounters now() {
+    StatsRegistry &stats = StatsRegistry::shared();
+    return {stats.value(CoreMetric::Attaches), stats.value(CoreMetric::MethodLookups),
+            stats.value(CoreMetric::FieldLookups)};
+  }
+};
+
+void printCounters(const CacheCounters &before, const CacheCounters &after, uint64_t operations) {
+  double ops = operations ? static_cast<double>(operations) : 1.0;
+  int64_t attaches = after.attaches - before.attaches;
+  int64_t methods = after.methodLookups - before.methodLookups;
+  int64_t fields = after.fieldLookups - before.fieldLookups;
+  printf("%-22s %8s attaches=%lld (%.3f/op) method_lookups=%lld (%.3f/op) field_lookups=%lld (%.3f/op)\n",
+         "", "", (long long) attaches, attaches / ops, (long long) methods, methods / ops,
+         (long long) fields, fields / ops);
+  fflush(stdout);
+}
+
+void runCase(const Mix &mix, int threads, double seconds) {
+  std::atomic<bool> go(false);
+  std::atomic<bool> stop(false);
+  std::atomic<int> ready(0);
+  std::vector<std::unique_ptr<LatencyHistogram>> histograms;
+  std::vector<uint64_t> counts(threads, 0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    histograms.emplace_back(new LatencyHistogram());
+  }
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      Tools::attachJniEnv();
+      {
+        Operation operation = mix.factory();
+        //warm up resolution and JIT outside the measured window
+        for (int i = 0; i < 1000; ++i) {
+          operation(i);
+        }
+        ready++;
+        while (!go.load()) {
+          std::this_thread::yield();
+        }
+        LatencyHistogram &histogram = *histograms[t];
+        int i = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+          uint64_t start = LatencyHistogram::nowNanos();
+          operation(i++);
+          histogram.record(LatencyHistogram::nowNanos() - start);
+        }
+        counts[t] = i;
+      }
+      Tools::detachJniEnv();
+    });
+  }
+  while (ready.load() < threads) {
+    std::this_thread::yield();
+  }
+  CacheCounters before = CacheCounters::now();
+  uint64_t start = LatencyHistogram::nowNanos();
+  go = true;
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  double elapsed = (LatencyHistogram::nowNanos() - start) / 1e9;
+  CacheCounters after = CacheCounters::now();
+
+  LatencyHistogram merged;
+  uint64_t total = 0;
+  for (int t = 0; t < threads; ++t) {
+    merged.merge(*histograms[t]);
+    total += counts[t];
+  }
+  printLatencyRow(mix.name, threads, total / elapsed, merged);
+  printCounters(before, after, total);
+}
+
+}
+
+int main(int argc, char **argv) {
+  HostJvm jvm;
+  std::vector<std::string> threadCounts = split(option(argc, argv, "threads", "1,2,4,8,16,32,64"));
+  double seconds = atof(option(argc, argv, "seconds", "2").c_str());
+  std::vector<std::string> selected = split(
+          option(argc, argv, "mix", "attach,static,instance,field,string,bytes,mixed"));
+
+  printLatencyHeader();
+  for (const Mix &mix : buildMixes()) {
+    if (std::find(selected.begin(), selected.end(), mix.name) == selected.end()) {
+      continue;
+    }
+    for (const std::string &threads : threadCounts) {
+      runCase(mix, atoi(threads.c_str()), seconds);
+    }
+  }
+  return 0;
+}
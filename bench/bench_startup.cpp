@@ -0,0 +1,350 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+//Cold start costs, each launch in a fresh process with a fresh embedded JVM: JVM creation,
+//safejni::init, RegisterNatives on generated classes with many natives, and the first,
+//second (warm) and pre-resolved (cached ids, raw JNI) cost of CallStatic/Call/Get over N
+//distinct members. The driver re-runs itself --launches times and prints min/median/max.
+//  --launches=10  --natives=100,1000  --members=100  --jvm-opts=-Xshare:off,-Xint
+
+#include "bench_common.h"
+
+#include <algorithm>
+#include <map>
+#include <unistd.h>
+
+using namespace safejni;
+using namespace safejni::bench;
+
+namespace {
+
+#pragma mark Class File Generation
+
+//Minimal class file writer (version 52, no stack maps needed for straight line code) so the
+//benchmark can define classes with hundreds of members without shipping generated sources.
+class ClassWriter {
+public:
+  explicit ClassWriter(const std::string &name) : name_(name) {
+    thisClass_ = classRef(name);
+    superClass_ = classRef("java/lang/Object");
+    objectInit_ = methodRef("java/lang/Object", "<init>", "()V");
+    code_ = utf8("Code");
+  }
+
+  void addField(const std::string &name, const std::string &descriptor) {
+    u2(fields_, 0x0001);
+    u2(fields_, utf8(name));
+    u2(fields_, utf8(descriptor));
+    u2(fields_, 0);
+    fieldCount_++;
+  }
+
+  void addMethod(uint16_t flags, const std::string &name, const std::string &descriptor,
+                 const std::vector<uint8_t> &code, uint16_t maxStack, uint16_t maxLocals) {
+    u2(methods_, flags);
+    u2(methods_, utf8(name));
+    u2(methods_, utf8(descriptor));
+    if (code.empty()) {
+      u2(methods_, 0);
+    } else {
+      u2(methods_, 1);
+      u2(methods_, code_);
+      u4(methods_, static_cast<uint32_t>(12 + code.size()));
+      u2(methods_, maxStack);
+      u2(methods_, maxLocals);
+      u4(methods_, static_cast<uint32_t>(code.size()));
+      methods_.insert(methods_.end(), code.begin(), code.end());
+      u2(methods_, 0);
+      u2(methods_, 0);
+    }
+    methodCount_++;
+  }
+
+  //public <init>()V calling Object.<init>
+  void addDefaultConstructor() {
+    std::vector<uint8_t> code = {0x2a, 0xb7, static_cast<uint8_t>(objectInit_ >> 8),
+                                 static_cast<uint8_t>(objectInit_), 0xb1};
+    addMethod(0x0001, "<init>", "()V", code, 1, 1);
+  }
+
+  std::vector<uint8_t> bytes() const {
+    std::vector<uint8_t> out;
+    u4(out, 0xcafebabe);
+    u2(out, 0);
+    u2(out, 52);
+    u2(out, poolCount_);
+    out.insert(out.end(), pool_.begin(), pool_.end());
+    u2(out, 0x0021);
+    u2(out, thisClass_);
+    u2(out, superClass_);
+    u2(out, 0);
+    u2(out, fieldCount_);
+    out.insert(out.end(), fields_.begin(), fields_.end());
+    u2(out, methodCount_);
+    out.insert(out.end(), methods_.begin(), methods_.end());
+    u2(out, 0);
+    return out;
+  }
+
+  const std::string &name() const { return name_; }
+
+private:
+  static void u2(std::vector<uint8_t> &out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+  }
+
+  static void u4(std::vector<uint8_t> &out, uint32_t value) {
+    u2(out, static_cast<uint16_t>(value >> 16));
+    u2(out, static_cast<uint16_t>(value));
+  }
+
+  uint16_t utf8(const std::string &value) {
+    auto it = utf8s_.find(value);
+    if (it != utf8s_.end()) {
+      return it->second;
+    }
+    pool_.push_back(1);
+    u2(pool_, static_cast<uint16_t>(value.size()));
+    pool_.insert(pool_.end(), value.begin(), value.end());
+    return utf8s_[value] = poolCount_++;
+  }
+
+  uint16_t classRef(const std::string &name) {
+    uint16_t nameIndex = utf8(name);
+    pool_.push_back(7);
+    u2(pool_, nameIndex);
+    return poolCount_++;
+  }
+
+  uint16_t methodRef(const std::string &owner, const std::string &name, const std::string &descriptor) {
+    uint16_t ownerIndex = classRef(owner);
+    uint16_t nameIndex = utf8(name);
+    uint16_t descriptorIndex = utf8(descriptor);
+    pool_.push_back(12);
+    u2(pool_, nameIndex);
+    u2(pool_, descriptorIndex);
+    uint16_t nameAndType = poolCount_++;
+    pool_.push_back(10);
+    u2(pool_, ownerIndex);
+    u2(pool_, nameAndType);
+    return poolCount_++;
+  }
+
+  std::string name_;
+  std::vector<uint8_t> pool_;
+  uint16_t poolCount_ = 1;
+  std::map<std::string, uint16_t> utf8s_;
+  uint16_t thisClass_;
+  uint16_t superClass_;
+  uint16_t objectInit_;
+  uint16_t code_;
+  std::vector<uint8_t> fields_;
+  std::vector<uint8_t> methods_;
+  uint16_t fieldCount_ = 0;
+  uint16_t methodCount_ = 0;
+};
+
+std::string member(const char *prefix, int index) {
+  return prefix + std::to_string(index);
+}
+
+void defineClass(JNIEnv *env, const ClassWriter &writer) {
+  jclass loaderClass = env->FindClass("java/lang/ClassLoader");
+  jmethodID systemLoader = env->GetStaticMethodID(loaderClass, "getSystemClassLoader",
+                                                  "()Ljava/lang/ClassLoader;");
+  jobject loader = env->CallStaticObjectMethod(loaderClass, systemLoader);
+  std::vector<uint8_t> bytes = writer.bytes();
+  jclass clazz = env->DefineClass(writer.name().c_str(), loader,
+                                  reinterpret_cast<const jbyte *>(bytes.data()),
+                                  static_cast<jsize>(bytes.size()));
+  Tools::checkException(env);
+  env->DeleteLocalRef(clazz);
+  env->DeleteLocalRef(loader);
+  env->DeleteLocalRef(loaderClass);
+}
+
+jint JNICALL nativeIdentity(JNIEnv *, jclass, jint value) {
+  return value;
+}
+
+#pragma mark Child Process
+
+void result(const std::string &name, uint64_t nanos, int count = 1) {
+  printf("RESULT %s %.1f\n", name.c_str(), static_cast<double>(nanos) / count);
+}
+
+template<typename F>
+uint64_t timed(F fn) {
+  uint64_t start = LatencyHistogram::nowNanos();
+  fn();
+  return LatencyHistogram::nowNanos() - start;
+}
+
+void measureRegisterNatives(JNIEnv *env, int natives) {
+  ClassWriter writer("safejni/bench/gen/Natives" + std::to_string(natives));
+  for (int i = 0; i < natives; ++i) {
+    writer.addMethod(0x0109, member("n", i), "(I)I", std::vector<uint8_t>(), 0, 0);
+  }
+  result("define_natives_" + std::to_string(natives), timed([&] { defineClass(env, writer); }));
+
+  std::vector<std::string> names;
+  for (int i = 0; i < natives; ++i) {
+    names.push_back(member("n", i));
+  }
+  std::vector<JNINativeMethod> methods(natives);
+  for (int i = 0; i < natives; ++i) {
+    methods[i].name = const_cast<char *>(names[i].c_str());
+    methods[i].signature = const_cast<char *>("(I)I");
+    methods[i].fnPtr = reinterpret_cast<void *>(nativeIdentity);
+  }
+  result("register_natives_" + std::to_string(natives), timed([&] {
+    RegisterNatives(writer.name(), methods.data(), natives);
+  }));
+}
+
+void measureFirstCalls(JNIEnv *env, int members) {
+  ClassWriter writer("safejni/bench/gen/Members" + std::to_string(members));
+  writer.addDefaultConstructor();
+  for (int i = 0; i < members; ++i) {
+    writer.addMethod(0x0009, member("s", i), "(I)I", {0x1a, 0xac}, 1, 1);
+    writer.addMethod(0x0001, member("m", i), "(I)I", {0x1b, 0xac}, 1, 2);
+    writer.addField(member("f", i), "I");
+  }
+  defineClass(env, writer);
+  const std::string &className = writer.name();
+
+  JNIObjectPtr object = JNIObject::NewObject(className, "()V");
+  jclass clazz = env->FindClass(className.c_str());
+  std::vector<jmethodID> statics, instances;
+  std::vector<jfieldID> fields;
+
+  //cold: first use of each member, warm: the same again (safejni resolves on every call)
+  for (const char *phase : {"cold", "warm"}) {
+    result(std::string("callstatic_") + phase, timed([&] {
+      for (int i = 0; i < members; ++i) {
+        CallStatic<int32_t>(className, member("s", i), "", 1);
+      }
+    }), members);
+    result(std::string("call_") + phase, timed([&] {
+      for (int i = 0; i < members; ++i) {
+        Call<int32_t>(object->instance, clazz, member("m", i), "", 1);
+      }
+    }), members);
+    result(std::string("get_") + phase, timed([&] {
+      for (int i = 0; i < members; ++i) {
+        Get<int32_t>(object->instance, member("f", i), "");
+      }
+    }), members);
+  }
+
+  //cached: ids resolved up front, the floor a resolution cache could reach
+  for (int i = 0; i < members; ++i) {
+    statics.push_back(env->GetStaticMethodID(clazz, member("s", i).c_str(), "(I)I"));
+    instances.push_back(env->GetMethodID(clazz, member("m", i).c_str(), "(I)I"));
+    fields.push_back(env->GetFieldID(clazz, member("f", i).c_str(), "I"));
+  }
+  result("callstatic_cached", timed([&] {
+    for (int i = 0; i < members; ++i) {
+      env->CallStaticIntMethod(clazz, statics[i], 1);
+    }
+  }), members);
+  result("call_cached", timed([&] {
+    for (int i = 0; i < members; ++i) {
+      env->CallIntMethod(object->instance, instances[i], 1);
+    }
+  }), members);
+  result("get_cached", timed([&] {
+    for (int i = 0; i < members; ++i) {
+      env->GetIntField(object->instance, fields[i]);
+    }
+  }), members);
+  env->DeleteLocalRef(clazz);
+}
+
+int runChild(int argc, char **argv) {
+  std::vector<std::string> jvmOptions = split(option(argc, argv, "jvm-opts", ""));
+  HostJvm jvm(jvmOptions);
+  result("jvm_create", jvm.createNanos);
+  result("safejni_init", jvm.initNanos);
+  for (const std::string &natives : split(option(argc, argv, "natives", "100,1000"))) {
+    measureRegisterNatives(jvm.env, atoi(natives.c_str()));
+  }
+  measureFirstCalls(jvm.env, atoi(option(argc, argv, "members", "100").c_str()));
+  fflush(stdout);
+  return 0;
+}
+
+#pragma mark Driver
+
+//single quoted for /bin/sh
+std::string quote(const std::string &value) {
+  std::string quoted = "'";
+  for (char c : value) {
+    quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+  }
+  return quoted + "'";
+}
+
+int runDriver(int argc, char **argv) {
+  int launches = atoi(option(argc, argv, "launches", "10").c_str());
+  //popen goes through /bin/sh, where /proc/self/exe would be the shell: resolve it here
+  char self[4096];
+  ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (length <= 0) {
+    perror("readlink");
+    return 1;
+  }
+  self[length] = '\0';
+  std::string command = quote(self) + " --child";
+  for (int i = 1; i < argc; ++i) {
+    command += " " + quote(argv[i]);
+  }
+
+  std::vector<std::string> order;
+  std::map<std::string, std::vector<double>> samples;
+  for (int launch = 0; launch < launches; ++launch) {
+    FILE *child = popen(command.c_str(), "r");
+    if (!child) {
+      perror("popen");
+      return 1;
+    }
+    char line[256];
+    char name[128];
+    double nanos;
+    while (fgets(line, sizeof(line), child)) {
+      if (sscanf(line, "RESULT %127s %lf", name, &nanos) == 2) {
+        if (samples.find(name) == samples.end()) {
+          order.push_back(name);
+        }
+        samples[name].push_back(nanos);
+      }
+    }
+    if (pclose(child) != 0) {
+      fprintf(stderr, "launch %d failed\n", launch);
+    }
+  }
+
+  printf("%-26s %8s %14s %14s %14s\n", "stage", "launches", "min(ns)", "median(ns)", "max(ns)");
+  for (const std::string &stage : order) {
+    std::vector<double> &values = samples[stage];
+    std::sort(values.begin(), values.end());
+    printf("%-26s %8zu %14.0f %14.0f %14.0f\n", stage.c_str(), values.size(), values.front(),
+           values[values.size() / 2], values.back());
+  }
+  return 0;
+}
+
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == "--child") {
+      return runChild(argc, argv);
+    }
+  }
+  return runDriver(argc, argv);
+}
@@ -0,0 +1,30 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+ */
+
+package safejni.bench;
+
+/** Call targets for the native benchmarks. */
+public class Fixture {
+    public int counter;
+    public String name = "fixture";
+
+    public static int staticAdd(int a, int b) {
+        return a + b;
+    }
+
+    public int add(int value) {
+        counter += value;
+        return counter;
+    }
+
+    public static String echo(String value) {
+        return value;
+    }
+
+    public static byte[] echoBytes(byte[] value) {
+        return value;
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+ */
+
+package safejni.bench;
+
+import com.sun.management.GarbageCollectionNotificationInfo;
+
+import java.lang.management.GarbageCollectorMXBean;
+import java.lang.management.ManagementFactory;
+import java.lang.management.RuntimeMXBean;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.ThreadLocalRandom;
+
+import javax.management.NotificationEmitter;
+import javax.management.openmbean.CompositeData;
+
+/**
+ * Background allocation pressure plus a log of GC pauses, timestamped with System.nanoTime()
+ * so native code can line them up with its own steady clock samples. Whole concurrent cycles
+ * (ZGC and Shenandoah cycles, CMS) mostly run alongside the application and are left out; their
+ * stop-the-world phases are reported separately as pauses.
+ */
+public final class GcPressure {
+    private static volatile boolean running;
+    private static Thread allocator;
+    private static final List<long[]> events = new ArrayList<>();
+    private static boolean listening;
+    //System.nanoTime() at JVM start, GcInfo times are milliseconds of uptime
+    private static long startNanos;
+
+    /** Allocates bytesPerMillisecond of short lived garbage and keeps retainedMegabytes alive. */
+    public static synchronized void start(final int bytesPerMillisecond, final int retainedMegabytes) {
+        listen();
+        running = true;
+        allocator = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                byte[][] retained = new byte[Math.max(retainedMegabytes, 1) * 16][];
+                ThreadLocalRandom random = ThreadLocalRandom.current();
+                long next = System.nanoTime();
+                while (running) {
+                    int allocated = 0;
+                    while (allocated < bytesPerMillisecond) {
+                        int size = 64 + random.nextInt(16 * 1024);
+                        byte[] garbage = new byte[size];
+                        allocated += size;
+                        if (retainedMegabytes > 0 && random.nextInt(64) == 0) {
+                            retained[random.nextInt(retained.length)] = new byte[64 * 1024];
+                        }
+                        garbage[0] = 1;
+                    }
+                    next += 1000000L;
+                    long sleep = next - System.nanoTime();
+                    if (sleep > 0) {
+                        try {
+                            Thread.sleep(sleep / 1000000L, (int) (sleep % 1000000L));
+                        } catch (InterruptedException e) {
+                            return;
+                        }
+                    }
+                }
+            }
+        }, "safejni-gc-pressure");
+        allocator.setDaemon(true);
+        allocator.start();
+    }
+
+    public static synchronized void stop() throws InterruptedException {
+        running = false;
+        if (allocator != null) {
+            allocator.join();
+            allocator = null;
+        }
+    }
+
+    /** Pauses seen so far as {startNanos, endNanos} pairs, flattened. */
+    public static long[] drainEvents() {
+        synchronized (events) {
+            long[] result = new long[events.size() * 2];
+            for (int i = 0; i < events.size(); i++) {
+                result[i * 2] = events.get(i)[0];
+                result[i * 2 + 1] = events.get(i)[1];
+            }
+            events.clear();
+            return result;
+        }
+    }
+
+    private static void listen() {
+        if (listening) {
+            return;
+        }
+        listening = true;
+        startNanos = uptimeAnchor();
+        for (GarbageCollectorMXBean bean : ManagementFactory.getGarbageCollectorMXBeans()) {
+            if (!(bean instanceof NotificationEmitter)) {
+                continue;
+            }
+            ((NotificationEmitter) bean).addNotificationListener((notification, handback) -> {
+                if (!GarbageCollectionNotificationInfo.GARBAGE_COLLECTION_NOTIFICATION.equals(notification.getType())) {
+                    return;
+                }
+                GarbageCollectionNotificationInfo info =
+                        GarbageCollectionNotificationInfo.from((CompositeData) notification.getUserData());
+                if (isConcurrent(info)) {
+                    return;
+                }
+                //the notification arrives after the fact, take the window from the GC itself
+                long start = startNanos + info.getGcInfo().getStartTime() * 1000000L;
+                long end = startNanos + info.getGcInfo().getEndTime() * 1000000L;
+                synchronized (events) {
+                    events.add(new long[]{start, end});
+                }
+            }, null, null);
+        }
+    }
+
+    private static boolean isConcurrent(GarbageCollectionNotificationInfo info) {
+        //"G1 Concurrent GC" reports the remark and cleanup pauses, those are kept
+        String name = info.getGcName();
+        return info.getGcAction().endsWith("GC cycle") || name.endsWith("Cycles")
+                || name.equals("ConcurrentMarkSweep");
+    }
+
+    /** nanoTime of uptime zero, anchored right after an uptime millisecond tick. */
+    private static long uptimeAnchor() {
+        RuntimeMXBean runtime = ManagementFactory.getRuntimeMXBean();
+        long uptime = runtime.getUptime();
+        long next;
+        do {
+            next = runtime.getUptime();
+        } while (next == uptime);
+        return System.nanoTime() - next * 1000000L;
+    }
+}
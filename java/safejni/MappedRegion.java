@@ -0,0 +1,49 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+ */
+
+package safejni;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Java face of a range of a safejni::MappedFile. The buffer points straight into the mapping,
+ * which stays alive until close() is called or the buffer (with any slice or duplicate of it)
+ * becomes unreachable. The buffer must not be touched after close().
+ */
+public final class MappedRegion implements AutoCloseable {
+    private final ByteBuffer buffer;
+    private final NativeReleaser releaser;
+
+    private MappedRegion(ByteBuffer buffer, long handle) {
+        this.buffer = buffer;
+        //registered on the buffer, not on this wrapper, so holding only the buffer is enough
+        this.releaser = NativeReleaser.register(buffer, new Release(handle));
+    }
+
+    public ByteBuffer buffer() {
+        return buffer;
+    }
+
+    @Override
+    public void close() {
+        releaser.release();
+    }
+
+    private static final class Release implements Runnable {
+        private final long handle;
+
+        Release(long handle) {
+            this.handle = handle;
+        }
+
+        @Override
+        public void run() {
+            nativeRelease(handle);
+        }
+    }
+
+    private static native void nativeRelease(long handle);
+}
@@ -0,0 +1,70 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+ */
+
+package safejni;
+
+import java.util.function.BiConsumer;
+import java.util.function.Consumer;
+import java.util.function.Function;
+
+/**
+ * Java face of a C++ callable registered through safejni::NativeCallable.
+ * BiConsumer lets it serve as a CompletableFuture.whenComplete callback.
+ * The native side owns the callable; close() releases it, and so does the reference queue once
+ * the wrapper becomes unreachable. Calls after close() throw instead of reaching a stale callable.
+ */
+public final class NativeCallable implements Runnable, Consumer<Object>, Function<Object, Object>,
+        BiConsumer<Object, Object>, AutoCloseable {
+    private final long handle;
+    private final NativeReleaser releaser;
+
+    private NativeCallable(long handle) {
+        this.handle = handle;
+        this.releaser = NativeReleaser.register(this, new Release(handle));
+    }
+
+    @Override
+    public void run() {
+        nativeInvoke(handle, null, null);
+    }
+
+    @Override
+    public void accept(Object value) {
+        nativeInvoke(handle, value, null);
+    }
+
+    @Override
+    public Object apply(Object value) {
+        return nativeInvoke(handle, value, null);
+    }
+
+    @Override
+    public void accept(Object first, Object second) {
+        nativeInvoke(handle, first, second);
+    }
+
+    @Override
+    public void close() {
+        releaser.release();
+    }
+
+    private static final class Release implements Runnable {
+        private final long handle;
+
+        Release(long handle) {
+            this.handle = handle;
+        }
+
+        @Override
+        public void run() {
+            nativeRelease(handle);
+        }
+    }
+
+    private static native Object nativeInvoke(long handle, Object first, Object second);
+
+    private static native void nativeRelease(long handle);
+}
@@ -0,0 +1,31 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+ */
+
+package safejni;
+
+/**
+ * Java face of a safejni::InboundQueue. post() never blocks: the message is converted and
+ * pushed onto a lock-free native queue, and the native loop is woken through an eventfd.
+ * The native side owns the queue; posting after it has been destroyed throws
+ * IllegalStateException.
+ */
+public final class NativeQueue {
+    private final long handle;
+
+    private NativeQueue(long handle) {
+        this.handle = handle;
+    }
+
+    public void post(int what, Object payload) {
+        nativePost(handle, what, payload);
+    }
+
+    public void post(int what) {
+        nativePost(handle, what, null);
+    }
+
+    private static native void nativePost(long handle, int what, Object payload);
+}
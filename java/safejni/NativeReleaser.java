@@ -0,0 +1,70 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+ */
+
+package safejni;
+
+import java.lang.ref.PhantomReference;
+import java.lang.ref.ReferenceQueue;
+import java.util.Collections;
+import java.util.HashSet;
+import java.util.Set;
+
+/**
+ * Runs a native release once its referent becomes phantom reachable, or earlier through
+ * release(). Works on every Android API level (java.lang.ref.Cleaner needs API 33), with a
+ * single daemon thread draining the reference queue.
+ */
+final class NativeReleaser extends PhantomReference<Object> {
+    private static final ReferenceQueue<Object> QUEUE = new ReferenceQueue<>();
+    //phantom references must stay reachable themselves until they are enqueued
+    private static final Set<NativeReleaser> PENDING =
+            Collections.synchronizedSet(new HashSet<NativeReleaser>());
+
+    static {
+        Thread drainer = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                drain();
+            }
+        }, "safejni-releaser");
+        drainer.setDaemon(true);
+        drainer.start();
+    }
+
+    private final Runnable action;
+
+    private NativeReleaser(Object referent, Runnable action) {
+        super(referent, QUEUE);
+        this.action = action;
+    }
+
+    /** action must not reference the referent, or it never becomes unreachable. */
+    static NativeReleaser register(Object referent, Runnable action) {
+        NativeReleaser releaser = new NativeReleaser(referent, action);
+        PENDING.add(releaser);
+        return releaser;
+    }
+
+    /** Runs the action if it has not run yet; safe to call any number of times. */
+    void release() {
+        if (PENDING.remove(this)) {
+            clear();
+            action.run();
+        }
+    }
+
+    private static void drain() {
+        while (true) {
+            try {
+                ((NativeReleaser) QUEUE.remove()).release();
+            } catch (InterruptedException ignored) {
+                //daemon, keep draining
+            } catch (RuntimeException ignored) {
+                //a failed release must not stop the others
+            }
+        }
+    }
+}
@@ -0,0 +1,31 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+ */
+
+package safejni;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Snapshot of the native safejni metrics. Each call copies every metric in a single JNI
+ * transition; names() lines up index by index with the snapshot values.
+ */
+public final class Stats {
+    private Stats() {
+    }
+
+    public static native String[] names();
+
+    public static native long[] snapshot();
+
+    /**
+     * Writes the snapshot as native order longs into a direct buffer and returns how many
+     * metrics exist (only the ones that fit are written).
+     */
+    public static native int snapshotInto(ByteBuffer directBuffer);
+
+    /** Dumps the metrics in Prometheus text format to a local file. */
+    public static native boolean dump(String path);
+}
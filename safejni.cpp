@@ -6,13 +6,21 @@
 
 
 #include "safejni.h"
+#include "safejni_adaptive.h"
 
 #include <jni.h>
 #include <cstdlib>
-#include <android/log.h>
 
+#ifdef __ANDROID__
+#include <android/log.h>
 
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR  , "[CYAP:SafeJNI]",__VA_ARGS__)
+#else
+#include <cstdio>
+
+//host builds (desktop JVM benchmarks) log to stderr
+#define LOGE(...) (fprintf(stderr, "[CYAP:SafeJNI] " __VA_ARGS__), fputc('\n', stderr))
+#endif
 
 using std::string;
 using std::vector;
@@ -22,6 +30,20 @@ namespace safejni {
 
 JavaVM *Tools::javaVM = 0;
 
+size_t Tools::criticalPinThreshold = 256 * 1024;
+
+namespace {
+
+//conversion sites of the built in conversors, they pick their own transfer strategy
+TransferSite toJByteArraySite("toJObjectArray<byte>");
+TransferSite toVectorByteSite("toVectorByte");
+TransferSite toVectorFloatSite("toVectorFloat");
+//strings have no critical path that yields UTF-8: region is GetStringUTFRegion, elements is
+//GetStringUTFChars
+TransferSite toStringSite("toString", TransferSite::kRegion | TransferSite::kElements);
+
+}
+
 
 void init(JavaVM *vm, JNIEnv *env) {
   Tools::init(vm);
@@ -65,6 +87,7 @@ JNIEnv *Tools::attachJniEnv() {
   JNIEnv *jniEnv;
   if (javaVM) {
     int status = javaVM->AttachCurrentThread(&jniEnv, NULL);
+    countStat(CoreMetric::Attaches);
     if (status < 0) {
       throw JNIException("Could not attach the JNI environment to the current thread.");
     }
@@ -84,29 +107,44 @@ void Tools::detachJniEnv() {
 
 
 jobjectArray Tools::toJObjectArray(JNIEnv *env, const std::vector<std::string> &data) {
+  probes::ConvertScope probe("toJObjectArray<string>", static_cast<long>(data.size()));
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Marshal, "toJObjectArray<string>");
   jclass classId = env->FindClass("java/lang/String");
   jint size = data.size();
   jobjectArray joa = env->NewObjectArray(size, classId, 0);
+  env->DeleteLocalRef(classId);
+  checkException(env);
 
   for (int i = 0; i < size; i++) {
     jstring jstr = toJString(env, data[i]);
+    //an OutOfMemoryError leaves no room for further JNI calls but the ones below
+    if (!jstr) {
+      break;
+    }
     env->SetObjectArrayElement(joa, i, jstr);
-
+    env->DeleteLocalRef(jstr);
   }
-  env->DeleteLocalRef(classId);
 
-  checkException(env);
+  if (env->ExceptionCheck()) {
+    env->DeleteLocalRef(joa);
+    checkException(env);
+  }
   return joa;
 }
 
 jbyteArray Tools::toJObjectArray(JNIEnv *env, const std::vector<uint8_t> &data) {
+  probes::ConvertScope probe("toJObjectArray<byte>", static_cast<long>(data.size()));
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Marshal, "toJObjectArray<byte>");
   jbyteArray jba = env->NewByteArray(data.size());
-  env->SetByteArrayRegion(jba, 0, data.size(), (const jbyte *) &data[0]);
   checkException(env);
+  fill(env, jba, reinterpret_cast<const jbyte *>(data.data()), static_cast<jsize>(data.size()), 0,
+       toJByteArraySite);
   return jba;
 }
 
 jobject Tools::toHashMap(JNIEnv *env, const std::map<std::string, std::string> &data) {
+  probes::ConvertScope probe("toHashMap", static_cast<long>(data.size()));
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Marshal, "toHashMap");
   jclass classId = env->FindClass("java/util/HashMap");
   jmethodID methodId = env->GetMethodID(classId, "<init>", "()V");
   jobject hashmap = env->NewObject(classId, methodId);
@@ -130,18 +168,40 @@ std::string Tools::toString(JNIEnv *env, jstring str) {
   if (!str) {
     return std::string();
   }
-  jboolean isCopy;
-  const char *chars = env->GetStringUTFChars(str, &isCopy);
+  probes::ConvertScope probe("toString", 0);
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Marshal, "toString");
   std::string s;
-  if (chars) {
-    s = chars;
-    env->ReleaseStringUTFChars(str, chars);
+  //UTF-16 length as the size estimate, the UTF-8 length would cost a scan of its own
+  jsize length = env->GetStringLength(str);
+  size_t estimate = static_cast<size_t>(length);
+  ArrayTransfer strategy = estimate < TransferSite::minAdaptiveBytes() ? ArrayTransfer::Elements
+                                                                       : toStringSite.choose(estimate);
+  uint64_t start = LatencyHistogram::nowNanos();
+  if (strategy == ArrayTransfer::Region) {
+    jsize utfLength = env->GetStringUTFLength(str);
+    //the VM writes a terminating NUL after the region
+    s.resize(static_cast<size_t>(utfLength) + 1);
+    env->GetStringUTFRegion(str, 0, length, &s[0]);
+    s.resize(static_cast<size_t>(utfLength));
+  } else {
+    const char *chars = env->GetStringUTFChars(str, nullptr);
+    if (chars) {
+      s = chars;
+      env->ReleaseStringUTFChars(str, chars);
+    }
+  }
+  if (estimate >= TransferSite::minAdaptiveBytes()) {
+    toStringSite.record(estimate, strategy, LatencyHistogram::nowNanos() - start);
   }
+  probe.setSize(static_cast<long>(s.size()));
+  countStat(CoreMetric::BytesFromJava, static_cast<int64_t>(s.size()));
   checkException(env);
   return s;
 }
 
 std::vector<std::string> Tools::toVectorString(JNIEnv *env, jobjectArray array) {
+  probes::ConvertScope probe("toVectorString", 0);
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Marshal, "toVectorString");
   std::vector<std::string> result;
   if (array) {
     jint length = env->GetArrayLength(array);
@@ -152,6 +212,7 @@ std::vector<std::string> Tools::toVectorString(JNIEnv *env, jobjectArray array)
       env->DeleteLocalRef(valueJObject);
     }
   }
+  probe.setSize(static_cast<long>(result.size()));
   checkException(env);
   return result;
 }
@@ -161,9 +222,10 @@ std::vector<uint8_t> Tools::toVectorByte(JNIEnv *env, jbyteArray array) {
     return std::vector<uint8_t>();
   }
   jsize size = env->GetArrayLength(array);
+  probes::ConvertScope probe("toVectorByte", size);
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Marshal, "toVectorByte");
   std::vector<uint8_t> result(size);
-  env->GetByteArrayRegion(array, 0, size, (jbyte *) &result[0]);
-  checkException(env);
+  readInto(env, reinterpret_cast<jbyte *>(result.data()), array, size, 0, toVectorByteSite);
   return result;
 }
 
@@ -172,13 +234,16 @@ std::vector<float> Tools::toVectorFloat(JNIEnv *env, jfloatArray array) {
     return std::vector<float>();
   }
   jsize size = env->GetArrayLength(array);
+  probes::ConvertScope probe("toVectorFloat", size);
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Marshal, "toVectorFloat");
   std::vector<float> result(size);
-  env->GetFloatArrayRegion(array, 0, size, &result[0]);
-  checkException(env);
+  readInto(env, result.data(), array, size, 0, toVectorFloatSite);
   return result;
 }
 
 std::vector<jobject> Tools::toVectorJObject(JNIEnv *env, jobjectArray array) {
+  probes::ConvertScope probe("toVectorJObject", 0);
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Marshal, "toVectorJObject");
   std::vector<jobject> result;
   if (array) {
     jint length = env->GetArrayLength(array);
@@ -188,12 +253,15 @@ std::vector<jobject> Tools::toVectorJObject(JNIEnv *env, jobjectArray array) {
       result.push_back(valueJObject);
     }
   }
+  probe.setSize(static_cast<long>(result.size()));
   return result;
 }
 
 SPJNIMethodInfo
 Tools::getStaticMethodInfo(JNIEnv *env, const string &className, const string &methodName,
                            const char *signature) {
+  probes::ResolveScope probe(className.c_str(), methodName.c_str(), signature, 1);
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Resolve, "resolve");
   jclass classId = 0;
   jmethodID methodId = 0;
   classId = env->FindClass(className.c_str());
@@ -212,12 +280,16 @@ Tools::getStaticMethodInfo(JNIEnv *env, const string &className, const string &m
                        string("' class using the '") + signature + string("' signature."));
   }
 
+  probe.setResult(methodId);
+  countStat(CoreMetric::MethodLookups);
   return SPJNIMethodInfo(new JNIMethodInfo(classId, methodId));
 }
 
 SPJNIMethodInfo
 Tools::getMethodInfo(JNIEnv *env, const string &className, const string &methodName,
                      const char *signature) {
+  probes::ResolveScope probe(className.c_str(), methodName.c_str(), signature, 0);
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Resolve, "resolve");
   jclass classId = env->FindClass(className.c_str());
   checkException(env);
   if (!classId) {
@@ -236,12 +308,16 @@ Tools::getMethodInfo(JNIEnv *env, const string &className, const string &methodN
                        string("' class using the '") + signature + string("' signature."));
   }
 
+  probe.setResult(methodId);
+  countStat(CoreMetric::MethodLookups);
   return SPJNIMethodInfo(new JNIMethodInfo(classId, methodId));
 }
 
 SPJNIMethodInfo
 Tools::getMethodInfo(JNIEnv *env, jclass classId, const string &methodName,
                      const char *signature) {
+  probes::ResolveScope probe("", methodName.c_str(), signature, 0);
+  CpuStageScope cpu(CpuTimeProfiler::Stage::Resolve, "resolve");
   jmethodID methodId = 0;
   checkException(env);
 
@@ -254,6 +330,8 @@ Tools::getMethodInfo(JNIEnv *env, jclass classId, const string &methodName,
                        string("' class using the '") + signature + string("' signature."));
   }
 
+  probe.setResult(methodId);
+  countStat(CoreMetric::MethodLookups);
   return SPJNIMethodInfo(new JNIMethodInfo(classId, methodId, true));
 }
 
@@ -267,6 +345,7 @@ void Tools::checkException(JNIEnv *env) {
     string exceptionMessage = toString(env,
                                        reinterpret_cast<jstring>(env->CallObjectMethod(jthrowable,
                                                                                        methodInfo->methodId)));
+    countStat(CoreMetric::JavaExceptions);
     throw JNIException(exceptionMessage);
   }
 }
@@ -293,6 +372,7 @@ JNIObject::~JNIObject() {
     JNIEnv *jniEnv = Tools::attachJniEnv();
     if (globalRef) {
       jniEnv->DeleteGlobalRef(instance);
+      countStat(CoreMetric::LiveGlobalRefs, -1);
     } else {
       jniEnv->DeleteLocalRef(instance);
     }
@@ -302,6 +382,7 @@ JNIObject::~JNIObject() {
 void JNIObject::makeGlobalRef() {
   if (!globalRef) {
     this->instance = Tools::attachJniEnv()->NewGlobalRef(this->instance);
+    countStat(CoreMetric::LiveGlobalRefs);
     globalRef = true;
   }
 }
@@ -310,7 +391,8 @@ std::shared_ptr<JNIObject> JNIObject::CreateGlobal(jobject obj) {
   JNIObject *result = new JNIObject();
   JNIEnv *jniEnv = Tools::attachJniEnv();
   result->instance = jniEnv->NewGlobalRef(obj);
-  result->makeGlobalRef();
+  result->globalRef = true;
+  countStat(CoreMetric::LiveGlobalRefs);
   return std::shared_ptr<JNIObject>(result);
 }
 
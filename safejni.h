@@ -14,6 +14,18 @@
 #include <map>
 #include <exception>
 #include <cstdint>
+#include <cstring>
+#include <new>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+#include "safejni_cputime.h"
+#include "safejni_critical_site.h"
+#include "safejni_probes.h"
+#include "safejni_resolution.h"
+#include "safejni_slowcall.h"
+#include "safejni_stats.h"
 
 
 namespace safejni {
@@ -93,10 +105,14 @@ public:
   static void detachJniEnv();
 
   static jstring toJString(JNIEnv *env, const char *str) {
+    //no strlen just for the probe, the length is reported as unknown
+    probes::ConvertScope probe("toJString", -1);
+    CpuStageScope cpu(CpuTimeProfiler::Stage::Marshal, "toJString");
     return env->NewStringUTF(str);
   }
 
   inline static jstring toJString(JNIEnv *env, const std::string &str) {
+    countStat(CoreMetric::BytesToJava, static_cast<int64_t>(str.size()));
     return toJString(env, str.c_str());
   }
 
@@ -132,6 +148,9 @@ public:
 
   static void clearException(JNIEnv *env);
 
+  //byte size from which fill/readInto pin the array instead of using a region copy
+  static size_t criticalPinThreshold;
+
 };
 
 void init(JavaVM *javaVM, JNIEnv *env);
@@ -198,6 +217,22 @@ public:
   JNIObject *instance_;
 };
 
+class LocalRefClear {
+public:
+  LocalRefClear(JNIEnv *env, jobject ref) : env_(env), ref_(ref) {
+
+  }
+
+  ~LocalRefClear() {
+    if (ref_) {
+      env_->DeleteLocalRef(ref_);
+    }
+  }
+
+  JNIEnv *env_;
+  jobject ref_;
+};
+
 #pragma mark C++ To JNI conversion templates
 
 template<typename T>
@@ -651,6 +686,233 @@ struct JNICaller<double, Args...> {
   }
 };
 
+#pragma mark JNI Primitive Array Traits
+
+//maps a java primitive array type to its element type, region and elements accessors
+template<typename A>
+struct JNIArrayTraits;
+
+#define SAFEJNI_ARRAY_TRAITS(ArrayT, ElementT, Name) \
+template<> \
+struct JNIArrayTraits<ArrayT> { \
+  using ElementType = ElementT; \
+  inline static ArrayT newArray(JNIEnv *env, jsize length) { return env->New##Name##Array(length); } \
+  inline static void getRegion(JNIEnv *env, ArrayT array, jsize start, jsize length, ElementT *buf) { \
+    env->Get##Name##ArrayRegion(array, start, length, buf); \
+  } \
+  inline static void setRegion(JNIEnv *env, ArrayT array, jsize start, jsize length, const ElementT *buf) { \
+    env->Set##Name##ArrayRegion(array, start, length, buf); \
+  } \
+  inline static ElementT *getElements(JNIEnv *env, ArrayT array) { \
+    return env->Get##Name##ArrayElements(array, nullptr); \
+  } \
+  inline static void releaseElements(JNIEnv *env, ArrayT array, ElementT *elements, jint mode) { \
+    env->Release##Name##ArrayElements(array, elements, mode); \
+  } \
+};
+
+SAFEJNI_ARRAY_TRAITS(jbooleanArray, jboolean, Boolean)
+SAFEJNI_ARRAY_TRAITS(jbyteArray, jbyte, Byte)
+SAFEJNI_ARRAY_TRAITS(jcharArray, jchar, Char)
+SAFEJNI_ARRAY_TRAITS(jshortArray, jshort, Short)
+SAFEJNI_ARRAY_TRAITS(jintArray, jint, Int)
+SAFEJNI_ARRAY_TRAITS(jlongArray, jlong, Long)
+SAFEJNI_ARRAY_TRAITS(jfloatArray, jfloat, Float)
+SAFEJNI_ARRAY_TRAITS(jdoubleArray, jdouble, Double)
+
+#undef SAFEJNI_ARRAY_TRAITS
+
+#pragma mark Array Region Transfer
+
+enum class ArrayTransfer {
+  Auto,     //region copy, or critical pin for blocks above Tools::criticalPinThreshold
+  Region,
+  Critical,
+  Elements  //Get<Type>ArrayElements, a pin or a VM side copy depending on the VM
+};
+
+template<typename A>
+inline void checkArrayBounds(JNIEnv *env, A array, jsize offset, jsize count) {
+  if (!array) {
+    throw JNIException("array transfer on a null java array");
+  }
+  jsize length = env->GetArrayLength(array);
+  if (offset < 0 || count < 0 || offset > length || count > length - offset) {
+    throw JNIException("array transfer out of bounds: offset " + std::to_string(offset) +
+                       ", count " + std::to_string(count) + ", length " + std::to_string(length));
+  }
+}
+
+template<typename A>
+inline bool useCriticalPin(ArrayTransfer mode, jsize count) {
+  using E = typename JNIArrayTraits<A>::ElementType;
+  return mode == ArrayTransfer::Critical ||
+         (mode == ArrayTransfer::Auto &&
+          static_cast<size_t>(count) * sizeof(E) >= Tools::criticalPinThreshold);
+}
+
+//Pins a primitive array with GetPrimitiveArrayCritical and records the hold time on release.
+//No JNI calls and no blocking are allowed while it is alive.
+template<typename A>
+class CriticalArrayGuard {
+public:
+  typedef typename JNIArrayTraits<A>::ElementType ElementType;
+
+  CriticalArrayGuard(JNIEnv *env, A array, CriticalSite &site, bool write = false)
+          : env_(env), array_(array), site_(site), mode_(write ? 0 : JNI_ABORT) {
+    data_ = static_cast<ElementType *>(env_->GetPrimitiveArrayCritical(array_, nullptr));
+    if (!data_) {
+      Tools::checkException(env_);
+      throw JNIException("GetPrimitiveArrayCritical failed");
+    }
+    start_ = LatencyHistogram::nowNanos();
+  }
+
+  //leaves data() null and clears the exception when the array can't be pinned
+  CriticalArrayGuard(JNIEnv *env, A array, CriticalSite &site, bool write, const std::nothrow_t &)
+          : env_(env), array_(array), site_(site), mode_(write ? 0 : JNI_ABORT) {
+    data_ = static_cast<ElementType *>(env_->GetPrimitiveArrayCritical(array_, nullptr));
+    if (!data_) {
+      env_->ExceptionClear();
+    }
+    start_ = LatencyHistogram::nowNanos();
+  }
+
+  ~CriticalArrayGuard() {
+    release();
+  }
+
+  CriticalArrayGuard(const CriticalArrayGuard &) = delete;
+
+  CriticalArrayGuard &operator=(const CriticalArrayGuard &) = delete;
+
+  ElementType *data() const { return data_; }
+
+  void release() {
+    if (!data_) {
+      return;
+    }
+    env_->ReleasePrimitiveArrayCritical(array_, data_, mode_);
+    data_ = nullptr;
+    site_.record(LatencyHistogram::nowNanos() - start_);
+  }
+
+private:
+  JNIEnv *env_;
+  A array_;
+  CriticalSite &site_;
+  jint mode_;
+  ElementType *data_;
+  uint64_t start_;
+};
+
+//copies `count` elements from `data` into an existing java array starting at `offset`
+template<typename A>
+void fill(JNIEnv *env, A javaArray, const typename JNIArrayTraits<A>::ElementType *data,
+          jsize count, jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  checkArrayBounds(env, javaArray, offset, count);
+  if (count == 0) {
+    return;
+  }
+  countStat(CoreMetric::BytesToJava, static_cast<int64_t>(count) * sizeof(*data));
+  if (useCriticalPin<A>(mode, count)) {
+    CriticalArrayGuard<A> pinned(env, javaArray, fillCriticalSite(), true, std::nothrow);
+    if (pinned.data()) {
+      std::memcpy(pinned.data() + offset, data, count * sizeof(*data));
+      return;
+    }
+  } else if (mode == ArrayTransfer::Elements) {
+    auto *elements = JNIArrayTraits<A>::getElements(env, javaArray);
+    if (elements) {
+      std::memcpy(elements + offset, data, count * sizeof(*data));
+      JNIArrayTraits<A>::releaseElements(env, javaArray, elements, 0);
+      return;
+    }
+    env->ExceptionClear();
+  }
+  JNIArrayTraits<A>::setRegion(env, javaArray, offset, count, data);
+  Tools::checkException(env);
+}
+
+//copies `count` elements of an existing java array starting at `offset` into `data`
+template<typename A>
+void readInto(JNIEnv *env, typename JNIArrayTraits<A>::ElementType *data, A javaArray,
+              jsize count, jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  checkArrayBounds(env, javaArray, offset, count);
+  if (count == 0) {
+    return;
+  }
+  countStat(CoreMetric::BytesFromJava, static_cast<int64_t>(count) * sizeof(*data));
+  if (useCriticalPin<A>(mode, count)) {
+    CriticalArrayGuard<A> pinned(env, javaArray, readIntoCriticalSite(), false, std::nothrow);
+    if (pinned.data()) {
+      std::memcpy(data, pinned.data() + offset, count * sizeof(*data));
+      return;
+    }
+  } else if (mode == ArrayTransfer::Elements) {
+    auto *elements = JNIArrayTraits<A>::getElements(env, javaArray);
+    if (elements) {
+      std::memcpy(data, elements + offset, count * sizeof(*data));
+      JNIArrayTraits<A>::releaseElements(env, javaArray, elements, JNI_ABORT);
+      return;
+    }
+    env->ExceptionClear();
+  }
+  JNIArrayTraits<A>::getRegion(env, javaArray, offset, count, data);
+  Tools::checkException(env);
+}
+
+template<typename A>
+inline void fill(A javaArray, const typename JNIArrayTraits<A>::ElementType *data, jsize count,
+                 jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  fill(Tools::attachJniEnv(), javaArray, data, count, offset, mode);
+}
+
+template<typename A>
+inline void readInto(typename JNIArrayTraits<A>::ElementType *data, A javaArray, jsize count,
+                     jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  readInto(Tools::attachJniEnv(), data, javaArray, count, offset, mode);
+}
+
+template<typename A>
+inline void fill(A javaArray, const std::vector<typename JNIArrayTraits<A>::ElementType> &data,
+                 jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  fill(Tools::attachJniEnv(), javaArray, data.data(), static_cast<jsize>(data.size()), offset, mode);
+}
+
+template<typename A>
+inline void readInto(std::vector<typename JNIArrayTraits<A>::ElementType> &data, A javaArray,
+                     jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  readInto(Tools::attachJniEnv(), data.data(), javaArray, static_cast<jsize>(data.size()), offset, mode);
+}
+
+//std::vector<uint8_t> is the byte payload type used by the conversors
+inline void fill(jbyteArray javaArray, const std::vector<uint8_t> &data,
+                 jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  fill(Tools::attachJniEnv(), javaArray, reinterpret_cast<const jbyte *>(data.data()),
+       static_cast<jsize>(data.size()), offset, mode);
+}
+
+inline void readInto(std::vector<uint8_t> &data, jbyteArray javaArray,
+                     jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  readInto(Tools::attachJniEnv(), reinterpret_cast<jbyte *>(data.data()), javaArray,
+           static_cast<jsize>(data.size()), offset, mode);
+}
+
+#if __cplusplus >= 202002L
+template<typename A>
+inline void fill(A javaArray, std::span<const typename JNIArrayTraits<A>::ElementType> data,
+                 jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  fill(Tools::attachJniEnv(), javaArray, data.data(), static_cast<jsize>(data.size()), offset, mode);
+}
+
+template<typename A>
+inline void readInto(std::span<typename JNIArrayTraits<A>::ElementType> data, A javaArray,
+                     jsize offset = 0, ArrayTransfer mode = ArrayTransfer::Auto) {
+  readInto(Tools::attachJniEnv(), data.data(), javaArray, static_cast<jsize>(data.size()), offset, mode);
+}
+#endif
+
 #pragma mark JNI Signature Utilities
 
 //helper method to append a JNI parameter signature to a buffer
@@ -770,8 +1032,13 @@ T CallStatic(const std::string &className,
     sig = signature.c_str();
   }
 
-  SPJNIMethodInfo methodInfo = Tools::getStaticMethodInfo(jniEnv, className, methodName,
-                                                          signature.c_str());
+  probes::StaticCallScope probe(className.c_str(), methodName.c_str(), sig, nargs);
+  ResolutionTracker::record("static", className.c_str(), methodName.c_str(), sig);
+  CpuCallScope cpu(className.c_str(), methodName.c_str(), sig);
+  SlowCallArguments<Args...> arguments(v...);
+  SlowCallScope slow("static", className.c_str(), methodName.c_str(), sig);
+  slow.setArguments(&arguments);
+  SPJNIMethodInfo methodInfo = Tools::getStaticMethodInfo(jniEnv, className, methodName, sig);
   JNIParamDestructor<nargs> paramDestructor(jniEnv);
   return JNICaller<T, decltype(CPPToJNIConversor<Args>::convert(jniEnv, v))...>::callStatic(jniEnv,
                                                                                             methodInfo->classId,
@@ -796,6 +1063,12 @@ T Call(jobject instance,
     sig = signature.c_str();
   }
 
+  probes::CallScope probe("", methodName.c_str(), sig, nargs);
+  ResolutionTracker::record("method", "", methodName.c_str(), sig);
+  CpuCallScope cpu("", methodName.c_str(), sig);
+  SlowCallArguments<Args...> arguments(v...);
+  SlowCallScope slow("call", "", methodName.c_str(), sig);
+  slow.setArguments(&arguments);
   SPJNIMethodInfo methodInfo = Tools::getMethodInfo(jniEnv, classId, methodName,
                                                     sig);
   JNIParamDestructor<nargs> paramDestructor(jniEnv);
@@ -818,6 +1091,10 @@ T callRawNonVirtual(jobject instance,
 
   static constexpr uint8_t nargs = sizeof...(Args);
   JNIEnv *jniEnv = Tools::attachJniEnv();
+  SlowCallArguments<Args...> arguments(v...);
+  SlowCallScope slow("nonvirtual", className.c_str(), methodName.c_str(), signature.c_str());
+  ResolutionTracker::record("nonvirtual", className.c_str(), methodName.c_str(), signature.c_str());
+  slow.setArguments(&arguments);
   SPJNIMethodInfo methodInfo = Tools::getMethodInfo(jniEnv, className, methodName,
                                                     signature.c_str());
   JNIParamDestructor<nargs> paramDestructor(jniEnv);
@@ -845,8 +1122,11 @@ T Get(jobject instance,
   }
 
   JNIEnv *jniEnv = Tools::attachJniEnv();
+  SlowCallScope slow("field", "", propertyName.c_str(), sig);
+  ResolutionTracker::record("field", "", propertyName.c_str(), sig);
   jclass clazz = jniEnv->GetObjectClass(instance);
   jfieldID fid = jniEnv->GetFieldID(clazz, propertyName.c_str(), sig);
+  countStat(CoreMetric::FieldLookups);
   if (clazz) {
     jniEnv->DeleteLocalRef(clazz);
   }
@@ -868,8 +1148,11 @@ void Set(jobject instance, const std::string &propertyName, const std::string &s
 
 
   JNIEnv *jniEnv = Tools::attachJniEnv();
+  SlowCallScope slow("field", "", propertyName.c_str(), sig);
+  ResolutionTracker::record("field", "", propertyName.c_str(), sig);
   jclass clazz = jniEnv->GetObjectClass(instance);
   jfieldID fid = jniEnv->GetFieldID(clazz, propertyName.c_str(), sig);
+  countStat(CoreMetric::FieldLookups);
   if (clazz) {
     jniEnv->DeleteLocalRef(clazz);
   }
@@ -886,8 +1169,11 @@ T GetStatic(const std::string &className, const std::string &propertyName,const
   }
 
   JNIEnv *jniEnv = Tools::attachJniEnv();
+  SlowCallScope slow("field", className.c_str(), propertyName.c_str(), sig);
+  ResolutionTracker::record("staticfield", className.c_str(), propertyName.c_str(), sig);
   jclass clazz = jniEnv->FindClass(className.c_str());
   jfieldID fid = jniEnv->GetStaticFieldID(clazz, propertyName.c_str(), sig);
+  countStat(CoreMetric::FieldLookups);
   T ret = JNICaller<T>::getStaticField(jniEnv, clazz, fid);
   if (clazz) {
     jniEnv->DeleteLocalRef(clazz);
@@ -925,6 +1211,12 @@ std::shared_ptr<JNIObject> JNIObject::NewObject(const std::string &className,
     signature_ = getJNISignature<void, Args...>(v...);
   }
 
+  probes::NewObjectScope probe(className.c_str(), signature_.c_str(), nargs);
+  CpuCallScope cpu(className.c_str(), "<init>", signature_.c_str());
+  SlowCallArguments<Args...> arguments(v...);
+  SlowCallScope slow("new", className.c_str(), "<init>", signature_.c_str());
+  ResolutionTracker::record("new", className.c_str(), "<init>", signature_.c_str());
+  slow.setArguments(&arguments);
   SPJNIMethodInfo methodInfo = Tools::getMethodInfo(jniEnv, className, "<init>",
                                                     signature_.c_str());
   JNIParamDestructor<nargs> paramDestructor(jniEnv);
@@ -948,6 +1240,12 @@ std::shared_ptr<JNIObject> JNIObject::NewObject(jclass classId,
     signature_ = getJNISignature<void, Args...>(v...);
   }
 
+  probes::NewObjectScope probe("", signature_.c_str(), nargs);
+  CpuCallScope cpu("", "<init>", signature_.c_str());
+  SlowCallArguments<Args...> arguments(v...);
+  SlowCallScope slow("new", "", "<init>", signature_.c_str());
+  ResolutionTracker::record("new", "", "<init>", signature_.c_str());
+  slow.setArguments(&arguments);
   SPJNIMethodInfo methodInfo = Tools::getMethodInfo(jniEnv, classId, "<init>",
                                                     signature_.c_str());
   JNIParamDestructor<nargs> paramDestructor(jniEnv);
@@ -966,8 +1264,11 @@ inline T JNIObject::Call(const std::string &methodName, Args... v) {
   if (className_.empty()) {
     classId = jniEnv->GetObjectClass(instance);
   } else {
+    ResolutionTracker::record("class", className_.c_str(), "", "");
     classId = jniEnv->FindClass(className_.c_str());
   }
+  //long lived attached threads never pop a local frame, so the class ref must not pile up
+  LocalRefClear classRef(jniEnv, classId);
 
   return safejni::Call<T, Args...>(instance, classId, methodName, memberSignature_, v...);
 }
@@ -0,0 +1,187 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_adaptive.h"
+
+#include <cstdio>
+
+using std::string;
+
+namespace safejni {
+
+
+namespace {
+
+//samples per strategy before a size class trusts its averages
+const uint64_t kWarmupSamples = 8;
+//one call in kProbeInterval runs a strategy other than the preferred one
+const uint64_t kProbeInterval = 64;
+
+const char *const strategyNames[] = {"region", "critical", "elements"};
+
+std::atomic<TransferSite *> firstSite(nullptr);
+
+int indexOf(ArrayTransfer strategy) {
+  switch (strategy) {
+    case ArrayTransfer::Critical:
+      return 1;
+    case ArrayTransfer::Elements:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+ArrayTransfer strategyAt(int index) {
+  static const ArrayTransfer strategies[] = {ArrayTransfer::Region, ArrayTransfer::Critical,
+                                             ArrayTransfer::Elements};
+  return strategies[index];
+}
+
+const int transferCollector = StatsRegistry::shared().addCollector([](std::vector<MetricSample> &out) {
+  for (TransferSite *site = TransferSite::first(); site; site = site->next()) {
+    for (int i = 0; i < 3; ++i) {
+      out.push_back({string("safejni_transfer_choices_total{site=\"") + site->name() +
+                     "\",strategy=\"" + strategyNames[i] + "\"}",
+                     static_cast<int64_t>(site->choices(strategyAt(i))), true});
+    }
+  }
+});
+
+}
+
+std::atomic<size_t> TransferSite::minAdaptiveBytes_(4 * 1024);
+std::atomic<size_t> TransferSite::maxCriticalBytes_(4 * 1024 * 1024);
+
+TransferSite::TransferSite(const char *name, unsigned allowed) : name_(name), allowed_(allowed) {
+  TransferSite *head = firstSite.load(std::memory_order_relaxed);
+  do {
+    next_ = head;
+  } while (!firstSite.compare_exchange_weak(head, this, std::memory_order_release,
+                                            std::memory_order_relaxed));
+}
+
+TransferSite *TransferSite::first() {
+  return firstSite.load(std::memory_order_acquire);
+}
+
+void TransferSite::setEnvelope(size_t minAdaptiveBytes, size_t maxCriticalBytes) {
+  minAdaptiveBytes_.store(minAdaptiveBytes, std::memory_order_relaxed);
+  maxCriticalBytes_.store(maxCriticalBytes, std::memory_order_relaxed);
+}
+
+int TransferSite::sizeClassOf(size_t bytes) {
+  int sizeClass = bytes ? 63 - __builtin_clzll(bytes) : 0;
+  return sizeClass < kSizeClasses ? sizeClass : kSizeClasses - 1;
+}
+
+unsigned TransferSite::allowedFor(size_t bytes) const {
+  unsigned allowed = allowed_;
+  if (bytes > maxCriticalBytes()) {
+    allowed &= ~kCritical;
+  }
+  return allowed ? allowed : kRegion;
+}
+
+int TransferSite::best(const SizeClass &sizeClass, unsigned allowed) const {
+  int best = -1;
+  uint64_t bestMean = 0;
+  for (int i = 0; i < kStrategies; ++i) {
+    if (!(allowed & (1u << i)) || sizeClass.samples[i].load(std::memory_order_relaxed) == 0) {
+      continue;
+    }
+    uint64_t mean = sizeClass.meanNanos[i].load(std::memory_order_relaxed);
+    if (best < 0 || mean < bestMean) {
+      best = i;
+      bestMean = mean;
+    }
+  }
+  return best < 0 ? 0 : best;
+}
+
+ArrayTransfer TransferSite::choose(size_t bytes) {
+  unsigned allowed = allowedFor(bytes);
+  SizeClass &sizeClass = sizeClasses_[sizeClassOf(bytes)];
+  uint64_t call = sizeClass.calls.fetch_add(1, std::memory_order_relaxed);
+
+  int chosen = -1;
+  //warm up: the least sampled strategy first
+  uint64_t fewest = kWarmupSamples;
+  for (int i = 0; i < kStrategies; ++i) {
+    uint64_t samples = sizeClass.samples[i].load(std::memory_order_relaxed);
+    if ((allowed & (1u << i)) && samples < fewest) {
+      chosen = i;
+      fewest = samples;
+    }
+  }
+  if (chosen < 0 && call % kProbeInterval == 0) {
+    //probe the allowed strategies in turn
+    int count = __builtin_popcount(allowed);
+    int nth = static_cast<int>((call / kProbeInterval) % count);
+    for (int i = 0; i < kStrategies; ++i) {
+      if ((allowed & (1u << i)) && nth-- == 0) {
+        chosen = i;
+        break;
+      }
+    }
+  }
+  if (chosen < 0) {
+    chosen = best(sizeClass, allowed);
+  }
+  choices_[chosen].fetch_add(1, std::memory_order_relaxed);
+  return strategyAt(chosen);
+}
+
+void TransferSite::record(size_t bytes, ArrayTransfer strategy, uint64_t nanos) {
+  SizeClass &sizeClass = sizeClasses_[sizeClassOf(bytes)];
+  int i = indexOf(strategy);
+  uint64_t samples = sizeClass.samples[i].fetch_add(1, std::memory_order_relaxed);
+  uint64_t mean = sizeClass.meanNanos[i].load(std::memory_order_relaxed);
+  //plain average while warming up, then an exponential one (1/8) to follow drift
+  uint64_t weight = samples < kWarmupSamples ? samples + 1 : 8;
+  int64_t delta = static_cast<int64_t>(nanos) - static_cast<int64_t>(mean);
+  sizeClass.meanNanos[i].store(static_cast<uint64_t>(static_cast<int64_t>(mean) + delta / static_cast<int64_t>(weight)),
+                               std::memory_order_relaxed);
+}
+
+ArrayTransfer TransferSite::preferred(size_t bytes) const {
+  if (bytes < minAdaptiveBytes()) {
+    return ArrayTransfer::Region;
+  }
+  return strategyAt(best(sizeClasses_[sizeClassOf(bytes)], allowedFor(bytes)));
+}
+
+uint64_t TransferSite::choices(ArrayTransfer strategy) const {
+  return choices_[indexOf(strategy)].load(std::memory_order_relaxed);
+}
+
+string TransferSite::describe() const {
+  string text = string(name_) + "\n";
+  char line[160];
+  for (int c = 0; c < kSizeClasses; ++c) {
+    const SizeClass &sizeClass = sizeClasses_[c];
+    uint64_t calls = sizeClass.calls.load(std::memory_order_relaxed);
+    if (!calls) {
+      continue;
+    }
+    size_t bytes = static_cast<size_t>(1) << c;
+    int written = snprintf(line, sizeof(line), "  >= %zu bytes: %llu calls, %s", bytes,
+                           (unsigned long long) calls, strategyNames[indexOf(preferred(bytes))]);
+    for (int i = 0; i < kStrategies && written > 0 && written < static_cast<int>(sizeof(line)); ++i) {
+      if (sizeClass.samples[i].load(std::memory_order_relaxed)) {
+        written += snprintf(line + written, sizeof(line) - written, " %s %lluns", strategyNames[i],
+                            (unsigned long long) sizeClass.meanNanos[i].load(std::memory_order_relaxed));
+      }
+    }
+    text += line;
+    text += "\n";
+  }
+  return text;
+}
+
+
+}
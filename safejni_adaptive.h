@@ -0,0 +1,136 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+#include "safejni_histogram.h"
+
+#include <atomic>
+#include <string>
+
+
+namespace safejni {
+
+
+#pragma mark Adaptive Transfer
+
+//A conversion site that picks its transfer strategy (region copy, critical pin, elements pin)
+//per payload size class from the latencies it observes: each allowed strategy is sampled
+//until warm, then the fastest is used, with a periodic probe of the others so the choice
+//follows the VM and the heap. Sites are meant to be statics (see SAFEJNI_TRANSFER_SITE) and
+//link themselves into a global list reported through StatsRegistry.
+class TransferSite {
+public:
+  static constexpr int kSizeClasses = 40;
+
+  //strategy masks
+  static constexpr unsigned kRegion = 1u << 0;
+  static constexpr unsigned kCritical = 1u << 1;
+  static constexpr unsigned kElements = 1u << 2;
+  static constexpr unsigned kAll = kRegion | kCritical | kElements;
+
+  explicit TransferSite(const char *name, unsigned allowed = kAll);
+
+  TransferSite(const TransferSite &) = delete;
+
+  TransferSite &operator=(const TransferSite &) = delete;
+
+  //Region, Critical or Elements for a payload of `bytes`
+  ArrayTransfer choose(size_t bytes);
+
+  void record(size_t bytes, ArrayTransfer strategy, uint64_t nanos);
+
+  //current choice for the size class, without counting as a call
+  ArrayTransfer preferred(size_t bytes) const;
+
+  uint64_t choices(ArrayTransfer strategy) const;
+
+  const char *name() const { return name_; }
+
+  //one line per size class that saw traffic: choice and mean ns per strategy
+  std::string describe() const;
+
+  //Safety envelope shared by every site: payloads under minAdaptiveBytes always use a region
+  //copy (measuring them costs more than any choice saves), critical pins are never chosen
+  //above maxCriticalBytes so the GC is not held off for long copies.
+  static void setEnvelope(size_t minAdaptiveBytes, size_t maxCriticalBytes);
+
+  static size_t minAdaptiveBytes() { return minAdaptiveBytes_.load(std::memory_order_relaxed); }
+
+  static size_t maxCriticalBytes() { return maxCriticalBytes_.load(std::memory_order_relaxed); }
+
+  static TransferSite *first();
+
+  TransferSite *next() const { return next_; }
+
+private:
+  static constexpr int kStrategies = 3;
+
+  struct SizeClass {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> samples[kStrategies] = {};
+    //moving average, updated without a lock: racing updates may drop a sample
+    std::atomic<uint64_t> meanNanos[kStrategies] = {};
+  };
+
+  static int sizeClassOf(size_t bytes);
+
+  unsigned allowedFor(size_t bytes) const;
+
+  int best(const SizeClass &sizeClass, unsigned allowed) const;
+
+  const char *name_;
+  unsigned allowed_;
+  SizeClass sizeClasses_[kSizeClasses];
+  std::atomic<uint64_t> choices_[kStrategies] = {};
+  TransferSite *next_ = nullptr;
+
+  static std::atomic<size_t> minAdaptiveBytes_;
+  static std::atomic<size_t> maxCriticalBytes_;
+};
+
+//a function local static site named after the source location
+#define SAFEJNI_TRANSFER_SITE_STR2(x) #x
+#define SAFEJNI_TRANSFER_SITE_STR(x) SAFEJNI_TRANSFER_SITE_STR2(x)
+#define SAFEJNI_TRANSFER_SITE() \
+  ([]() -> safejni::TransferSite & { \
+    static safejni::TransferSite site(__FILE__ ":" SAFEJNI_TRANSFER_SITE_STR(__LINE__)); \
+    return site; \
+  }())
+
+//fill() with the strategy chosen by the site
+template<typename A>
+void fill(JNIEnv *env, A javaArray, const typename JNIArrayTraits<A>::ElementType *data,
+          jsize count, jsize offset, TransferSite &site) {
+  size_t bytes = static_cast<size_t>(count) * sizeof(*data);
+  if (bytes < TransferSite::minAdaptiveBytes()) {
+    fill(env, javaArray, data, count, offset, ArrayTransfer::Region);
+    return;
+  }
+  ArrayTransfer strategy = site.choose(bytes);
+  uint64_t start = LatencyHistogram::nowNanos();
+  fill(env, javaArray, data, count, offset, strategy);
+  site.record(bytes, strategy, LatencyHistogram::nowNanos() - start);
+}
+
+//readInto() with the strategy chosen by the site
+template<typename A>
+void readInto(JNIEnv *env, typename JNIArrayTraits<A>::ElementType *data, A javaArray,
+              jsize count, jsize offset, TransferSite &site) {
+  size_t bytes = static_cast<size_t>(count) * sizeof(*data);
+  if (bytes < TransferSite::minAdaptiveBytes()) {
+    readInto(env, data, javaArray, count, offset, ArrayTransfer::Region);
+    return;
+  }
+  ArrayTransfer strategy = site.choose(bytes);
+  uint64_t start = LatencyHistogram::nowNanos();
+  readInto(env, data, javaArray, count, offset, strategy);
+  site.record(bytes, strategy, LatencyHistogram::nowNanos() - start);
+}
+
+
+}
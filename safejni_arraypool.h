@@ -0,0 +1,168 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+
+namespace safejni {
+
+
+#pragma mark Java Array Pool
+
+//Opt-in pool of global-ref java primitive arrays, bucketed by power-of-two size classes.
+//An acquired array may be longer than requested, so pass the used length along to java.
+//Arrays must be given back with release() once java no longer uses them.
+template<typename A>
+class JavaArrayPool {
+public:
+  using Traits = JNIArrayTraits<A>;
+  using ElementType = typename Traits::ElementType;
+
+  static constexpr int kMinSizeClass = 6;   // 64 elements
+  static constexpr int kMaxSizeClass = 30;  // 1G elements
+
+  struct Stats {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> releases{0};
+    std::atomic<uint64_t> dropped{0};
+
+    double hitRate() const {
+      uint64_t h = hits.load(std::memory_order_relaxed);
+      uint64_t total = h + misses.load(std::memory_order_relaxed);
+      return total ? static_cast<double>(h) / total : 0.0;
+    }
+  };
+
+  explicit JavaArrayPool(size_t maxPerBucket = 4) : maxPerBucket_(maxPerBucket) {}
+
+  JavaArrayPool(const JavaArrayPool &) = delete;
+
+  JavaArrayPool &operator=(const JavaArrayPool &) = delete;
+
+  ~JavaArrayPool() {
+    //attaching can throw (e.g. a static pool outliving the VM), the refs are then moot
+    try {
+      clear(Tools::attachJniEnv());
+    } catch (...) {
+    }
+  }
+
+  //returns a global ref array holding at least `length` elements
+  A acquire(JNIEnv *env, jsize length) {
+    int sizeClass = sizeClassOf(length);
+    if (sizeClass < 0) {
+      throw JNIException("JavaArrayPool: requested length out of range");
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<A> &bucket = buckets_[sizeClass - kMinSizeClass];
+      if (!bucket.empty()) {
+        A array = bucket.back();
+        bucket.pop_back();
+        stats_.hits.fetch_add(1, std::memory_order_relaxed);
+        countStat(CoreMetric::ArrayPoolHits);
+        return array;
+      }
+    }
+    stats_.misses.fetch_add(1, std::memory_order_relaxed);
+    countStat(CoreMetric::ArrayPoolMisses);
+    A local = Traits::newArray(env, static_cast<jsize>(1) << sizeClass);
+    Tools::checkException(env);
+    A global = static_cast<A>(env->NewGlobalRef(local));
+    env->DeleteLocalRef(local);
+    return global;
+  }
+
+  //acquires an array and copies `length` elements into its head with a single region copy
+  A acquire(JNIEnv *env, const ElementType *data, jsize length) {
+    A array = acquire(env, length);
+    if (length > 0) {
+      Traits::setRegion(env, array, 0, length, data);
+    }
+    if (env->ExceptionCheck()) {
+      //half written, drop it rather than pooling it
+      env->DeleteGlobalRef(array);
+      Tools::checkException(env);
+    }
+    return array;
+  }
+
+  //gives an array obtained from acquire() back to the pool
+  void release(JNIEnv *env, A array) {
+    if (!array) {
+      return;
+    }
+    stats_.releases.fetch_add(1, std::memory_order_relaxed);
+    jsize length = env->GetArrayLength(array);
+    int sizeClass = sizeClassOf(length);
+    if (sizeClass >= 0 && (static_cast<jsize>(1) << sizeClass) == length) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<A> &bucket = buckets_[sizeClass - kMinSizeClass];
+      if (bucket.size() < maxPerBucket_) {
+        bucket.push_back(array);
+        return;
+      }
+    }
+    stats_.dropped.fetch_add(1, std::memory_order_relaxed);
+    env->DeleteGlobalRef(array);
+  }
+
+  //drops every pooled array
+  void clear(JNIEnv *env) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &bucket : buckets_) {
+      for (A array : bucket) {
+        env->DeleteGlobalRef(array);
+      }
+      bucket.clear();
+    }
+  }
+
+  const Stats &stats() const { return stats_; }
+
+private:
+  static int sizeClassOf(jsize length) {
+    if (length < 0) {
+      return -1;
+    }
+    int sizeClass = kMinSizeClass;
+    while ((static_cast<jlong>(1) << sizeClass) < length) {
+      if (++sizeClass > kMaxSizeClass) {
+        return -1;
+      }
+    }
+    return sizeClass;
+  }
+
+  size_t maxPerBucket_;
+  std::mutex mutex_;
+  std::vector<A> buckets_[kMaxSizeClass - kMinSizeClass + 1];
+  Stats stats_;
+};
+
+typedef JavaArrayPool<jbyteArray> JavaByteArrayPool;
+typedef JavaArrayPool<jshortArray> JavaShortArrayPool;
+typedef JavaArrayPool<jintArray> JavaIntArrayPool;
+typedef JavaArrayPool<jlongArray> JavaLongArrayPool;
+typedef JavaArrayPool<jfloatArray> JavaFloatArrayPool;
+typedef JavaArrayPool<jdoubleArray> JavaDoubleArrayPool;
+
+//convenience overload for the std::vector<uint8_t> payloads used by CPPToJNIConversor
+inline jbyteArray acquirePooled(JNIEnv *env, JavaByteArrayPool &pool,
+                                const std::vector<uint8_t> &data) {
+  return pool.acquire(env, reinterpret_cast<const jbyte *>(data.data()),
+                      static_cast<jsize>(data.size()));
+}
+
+
+}
@@ -0,0 +1,242 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_callable.h"
+
+#include <thread>
+
+namespace safejni {
+
+
+// CallableRegistry
+
+CallableRegistry &CallableRegistry::shared() {
+  static CallableRegistry registry;
+  return registry;
+}
+
+namespace {
+
+const int callableCollector = StatsRegistry::shared().addCollector([](std::vector<MetricSample> &out) {
+  out.push_back({"safejni_live_callables", static_cast<int64_t>(CallableRegistry::shared().size()), false});
+});
+
+}
+
+CallableRegistry::~CallableRegistry() {
+  for (auto &segment : segments_) {
+    delete[] segment.load();
+  }
+}
+
+CallableRegistry::Slot *CallableRegistry::slotAt(uint32_t index) const {
+  size_t segment = index / kSegmentSize;
+  if (segment >= kMaxSegments) {
+    return nullptr;
+  }
+  Slot *slots = segments_[segment].load(std::memory_order_acquire);
+  return slots ? &slots[index % kSegmentSize] : nullptr;
+}
+
+jlong CallableRegistry::add(Invoker invoker, bool oneShot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t index;
+  if (!freeList_.empty()) {
+    index = freeList_.back();
+    freeList_.pop_back();
+  } else {
+    index = nextIndex_;
+    size_t segment = index / kSegmentSize;
+    if (segment >= kMaxSegments) {
+      throw JNIException("CallableRegistry: too many live callables");
+    }
+    if (!segments_[segment].load(std::memory_order_relaxed)) {
+      segments_[segment].store(new Slot[kSegmentSize], std::memory_order_release);
+    }
+    nextIndex_++;
+  }
+  Slot *slot = slotAt(index);
+  slot->invoker = std::move(invoker);
+  slot->oneShot = oneShot;
+  //added, not stored: a stale invocation may still hold a transient ref on the free slot
+  slot->refs.fetch_add(1, std::memory_order_acq_rel);
+  uint32_t generation = slot->generation.load(std::memory_order_relaxed) + 1;
+  slot->generation.store(generation, std::memory_order_release);
+  live_.fetch_add(1, std::memory_order_relaxed);
+  //index + 1 keeps 0 free as the null handle
+  return static_cast<jlong>((static_cast<uint64_t>(generation) << 32) | (index + 1));
+}
+
+bool CallableRegistry::invoke(jlong handle, JNIEnv *env, jobject first, jobject second,
+                              jobject &result) {
+  uint32_t index = static_cast<uint32_t>(handle & 0xffffffff) - 1;
+  uint32_t generation = static_cast<uint32_t>(static_cast<uint64_t>(handle) >> 32);
+  Slot *slot = slotAt(index);
+  if (!slot || slot->generation.load(std::memory_order_acquire) != generation) {
+    return false;
+  }
+  slot->refs.fetch_add(1, std::memory_order_acq_rel);
+  if (slot->generation.load(std::memory_order_acquire) != generation) {
+    unref(slot, index);
+    return false;
+  }
+  //a one-shot slot is claimed by whichever invocation moves the generation first
+  if (slot->oneShot) {
+    uint32_t expected = generation;
+    if (!slot->generation.compare_exchange_strong(expected, generation + 1,
+                                                  std::memory_order_acq_rel)) {
+      unref(slot, index);
+      return false;
+    }
+    release(slot, index);
+  }
+  try {
+    result = slot->invoker(env, first, second);
+  } catch (...) {
+    unref(slot, index);
+    throw;
+  }
+  unref(slot, index);
+  return true;
+}
+
+CallableRegistry::Slot *CallableRegistry::retire(jlong handle) {
+  uint32_t index = static_cast<uint32_t>(handle & 0xffffffff) - 1;
+  uint32_t generation = static_cast<uint32_t>(static_cast<uint64_t>(handle) >> 32);
+  Slot *slot = slotAt(index);
+  if (!slot) {
+    return nullptr;
+  }
+  //races with a one-shot invocation claiming the same slot, only one side may release it
+  uint32_t expected = generation;
+  if (!slot->generation.compare_exchange_strong(expected, generation + 1,
+                                                std::memory_order_acq_rel)) {
+    return nullptr;
+  }
+  release(slot, index);
+  return slot;
+}
+
+void CallableRegistry::remove(jlong handle) {
+  retire(handle);
+}
+
+void CallableRegistry::removeAndWait(jlong handle) {
+  Slot *slot = retire(handle);
+  if (!slot) {
+    return;
+  }
+  while (slot->pendingRecycle.load(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+}
+
+void CallableRegistry::release(Slot *slot, uint32_t index) {
+  slot->pendingRecycle.store(true, std::memory_order_release);
+  unref(slot, index);
+}
+
+void CallableRegistry::unref(Slot *slot, uint32_t index) {
+  if (slot->refs.fetch_sub(1, std::memory_order_acq_rel) != 1 ||
+      !slot->pendingRecycle.load(std::memory_order_acquire)) {
+    return;
+  }
+  Invoker released;
+  std::lock_guard<std::mutex> lock(mutex_);
+  //a stale invocation can reach zero too, only the first one frees the slot
+  if (!slot->pendingRecycle.exchange(false, std::memory_order_acq_rel)) {
+    return;
+  }
+  released.swap(slot->invoker);
+  freeList_.push_back(index);
+  live_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// NativeCallable
+
+jclass NativeCallable::classId_ = nullptr;
+jmethodID NativeCallable::constructor_ = nullptr;
+
+namespace {
+
+jobject JNICALL nativeInvoke(JNIEnv *env, jclass, jlong handle, jobject first, jobject second) {
+  jobject result = nullptr;
+  try {
+    if (!CallableRegistry::shared().invoke(handle, env, first, second, result)) {
+      jclass error = env->FindClass("java/lang/IllegalStateException");
+      env->ThrowNew(error, "NativeCallable has been released");
+      env->DeleteLocalRef(error);
+    }
+  } catch (const std::exception &e) {
+    if (!env->ExceptionCheck()) {
+      jclass error = env->FindClass("java/lang/RuntimeException");
+      env->ThrowNew(error, e.what());
+      env->DeleteLocalRef(error);
+    }
+  } catch (...) {
+    if (!env->ExceptionCheck()) {
+      jclass error = env->FindClass("java/lang/RuntimeException");
+      env->ThrowNew(error, "unknown native exception");
+      env->DeleteLocalRef(error);
+    }
+  }
+  return result;
+}
+
+void JNICALL nativeRelease(JNIEnv *, jclass, jlong handle) {
+  CallableRegistry::shared().remove(handle);
+}
+
+}
+
+void NativeCallable::registerNatives(JNIEnv *env, const char *className) {
+  jclass clazz = env->FindClass(className);
+  Tools::checkException(env);
+  if (!clazz) {
+    throw JNIException(std::string("Could not find the given class: ") + className);
+  }
+  static JNINativeMethod methods[] = {
+          {const_cast<char *>("nativeInvoke"),
+                  const_cast<char *>("(JLjava/lang/Object;Ljava/lang/Object;)Ljava/lang/Object;"),
+                  reinterpret_cast<void *>(nativeInvoke)},
+          {const_cast<char *>("nativeRelease"), const_cast<char *>("(J)V"),
+                  reinterpret_cast<void *>(nativeRelease)},
+  };
+  if (env->RegisterNatives(clazz, methods, sizeof(methods) / sizeof(methods[0])) < 0) {
+    env->DeleteLocalRef(clazz);
+    Tools::checkException(env);
+    throw JNIException("register failed");
+  }
+  constructor_ = env->GetMethodID(clazz, "<init>", "(J)V");
+  Tools::checkException(env);
+  if (classId_) {
+    env->DeleteGlobalRef(classId_);
+  }
+  classId_ = static_cast<jclass>(env->NewGlobalRef(clazz));
+  env->DeleteLocalRef(clazz);
+}
+
+JNIObjectPtr NativeCallable::Create(CallableRegistry::Invoker invoker, bool oneShot) {
+  if (!classId_) {
+    throw JNIException("NativeCallable::registerNatives has not been called");
+  }
+  JNIEnv *env = Tools::attachJniEnv();
+  jlong handle = CallableRegistry::shared().add(std::move(invoker), oneShot);
+  jobject local = env->NewObject(classId_, constructor_, handle);
+  if (!local) {
+    CallableRegistry::shared().remove(handle);
+    Tools::checkException(env);
+    throw JNIException("Could not create NativeCallable");
+  }
+  JNIObjectPtr result = JNIObject::CreateShared(local);
+  result->makeGlobalRef();
+  env->DeleteLocalRef(local);
+  return result;
+}
+
+
+}
@@ -0,0 +1,172 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+
+namespace safejni {
+
+
+#pragma mark Callable Handle Table
+
+//Maps jlong handles to native invokers. Lookups are lock free: slots live in segments that are
+//never moved, and a handle only matches while its slot generation is unchanged. remove() only
+//retires the handle, the slot is freed by whichever in-flight invocation finishes last, so a
+//callable may release its own handle. One-shot callables are retired by their first invocation.
+class CallableRegistry {
+public:
+  //receives the java arguments (possibly null) and returns a local ref or null
+  typedef std::function<jobject(JNIEnv *env, jobject first, jobject second)> Invoker;
+
+  static CallableRegistry &shared();
+
+  CallableRegistry() = default;
+
+  ~CallableRegistry();
+
+  CallableRegistry(const CallableRegistry &) = delete;
+
+  CallableRegistry &operator=(const CallableRegistry &) = delete;
+
+  jlong add(Invoker invoker, bool oneShot = false);
+
+  //false if the handle is stale
+  bool invoke(jlong handle, JNIEnv *env, jobject first, jobject second, jobject &result);
+
+  void remove(jlong handle);
+
+  //remove() that also returns only once no invocation of the handle is running, for invokers
+  //that point at an object about to be destroyed. Must not be called from such an invocation.
+  void removeAndWait(jlong handle);
+
+  size_t size() const { return live_.load(std::memory_order_relaxed); }
+
+private:
+  static constexpr size_t kSegmentSize = 1024;
+  static constexpr size_t kMaxSegments = 1024;
+
+  struct Slot {
+    //odd while the slot holds a callable
+    std::atomic<uint32_t> generation{0};
+    //in-flight invocations plus one while the handle is live
+    std::atomic<uint32_t> refs{0};
+    //set when the handle is retired, taken by whoever drops the last ref
+    std::atomic<bool> pendingRecycle{false};
+    bool oneShot = false;
+    Invoker invoker;
+  };
+
+  Slot *slotAt(uint32_t index) const;
+
+  //retires the slot once its generation has moved on
+  void release(Slot *slot, uint32_t index);
+
+  //drops a ref, the last one after a release frees the slot
+  void unref(Slot *slot, uint32_t index);
+
+  Slot *retire(jlong handle);
+
+  std::atomic<Slot *> segments_[kMaxSegments] = {};
+  std::mutex mutex_;
+  std::vector<uint32_t> freeList_;
+  uint32_t nextIndex_ = 0;
+  std::atomic<size_t> live_{0};
+};
+
+#pragma mark Callable Conversion Templates
+
+//java argument -> C++ callable parameter
+template<typename T>
+struct CallableArgument {
+  inline static T convert(JNIEnv *env, jobject obj) { return JNIToCPPConversor<T>::convert(env, obj); }
+};
+
+template<>
+struct CallableArgument<jobject> {
+  inline static jobject convert(JNIEnv *env, jobject obj) { return obj; }
+};
+
+template<>
+struct CallableArgument<JNIObjectPtr> {
+  inline static JNIObjectPtr convert(JNIEnv *env, jobject obj) { return JNIObject::CreateLocal(obj); }
+};
+
+//C++ callable result -> java return value (a new local ref)
+template<typename R>
+struct CallableResult {
+  inline static jobject convert(JNIEnv *env, const R &value) {
+    return CPPToJNIConversor<R>::convert(env, value);
+  }
+};
+
+template<>
+struct CallableResult<jobject> {
+  inline static jobject convert(JNIEnv *env, jobject value) { return value; }
+};
+
+template<>
+struct CallableResult<JNIObjectPtr> {
+  inline static jobject convert(JNIEnv *env, const JNIObjectPtr &value) {
+    return value ? env->NewLocalRef(value->instance) : nullptr;
+  }
+};
+
+#pragma mark Native Callables
+
+//Wraps C++ callables as instances of the bundled java class safejni.NativeCallable, which
+//implements Runnable, Consumer<Object>, Function<Object, Object> and BiConsumer<Object, Object>.
+//registerNatives() must run once on a thread that can see the class (e.g. JNI_OnLoad).
+class NativeCallable {
+public:
+  static void registerNatives(JNIEnv *env, const char *className = "safejni/NativeCallable");
+
+  //wraps a raw invoker, the returned object is a global ref
+  static JNIObjectPtr Create(CallableRegistry::Invoker invoker, bool oneShot = false);
+
+  template<typename F>
+  static JNIObjectPtr CreateRunnable(F fn) {
+    return Create([fn](JNIEnv *env, jobject, jobject) -> jobject {
+      fn();
+      return nullptr;
+    });
+  }
+
+  template<typename T, typename F>
+  static JNIObjectPtr CreateConsumer(F fn) {
+    return Create([fn](JNIEnv *env, jobject first, jobject) -> jobject {
+      fn(CallableArgument<T>::convert(env, first));
+      return nullptr;
+    });
+  }
+
+  template<typename T, typename R, typename F>
+  static JNIObjectPtr CreateFunction(F fn) {
+    return Create([fn](JNIEnv *env, jobject first, jobject) -> jobject {
+      return CallableResult<R>::convert(env, fn(CallableArgument<T>::convert(env, first)));
+    });
+  }
+
+  template<typename T, typename U, typename F>
+  static JNIObjectPtr CreateBiConsumer(F fn) {
+    return Create([fn](JNIEnv *env, jobject first, jobject second) -> jobject {
+      fn(CallableArgument<T>::convert(env, first), CallableArgument<U>::convert(env, second));
+      return nullptr;
+    });
+  }
+
+private:
+  static jclass classId_;
+  static jmethodID constructor_;
+};
+
+
+}
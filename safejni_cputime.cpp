@@ -0,0 +1,184 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_cputime.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <sys/resource.h>
+#include <unordered_map>
+
+using std::string;
+
+namespace safejni {
+
+
+std::atomic<bool> CpuTimeProfiler::enabled_(false);
+
+namespace {
+
+typedef std::unordered_map<string, CpuTimeStats> StatsMap;
+
+std::mutex statsMutex;
+
+StatsMap &methodStats() {
+  static StatsMap stats;
+  return stats;
+}
+
+StatsMap &stageStats() {
+  static StatsMap stats;
+  return stats;
+}
+
+thread_local CpuCallScope *currentCall = nullptr;
+thread_local int stageDepth = 0;
+
+int64_t toNanos(const timespec &ts) {
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void accumulate(CpuTimeStats &stats, const CpuSample &start, const CpuSample &end) {
+  stats.calls++;
+  stats.wallNs += end.wallNs - start.wallNs;
+  stats.cpuNs += end.cpuNs - start.cpuNs;
+  stats.voluntarySwitches += end.voluntarySwitches - start.voluntarySwitches;
+  stats.involuntarySwitches += end.involuntarySwitches - start.involuntarySwitches;
+}
+
+std::vector<std::pair<string, CpuTimeStats>> sorted(const StatsMap &stats) {
+  std::vector<std::pair<string, CpuTimeStats>> result(stats.begin(), stats.end());
+  std::sort(result.begin(), result.end(), [](const std::pair<string, CpuTimeStats> &a,
+                                             const std::pair<string, CpuTimeStats> &b) {
+    return a.second.cpuNs > b.second.cpuNs;
+  });
+  return result;
+}
+
+}
+
+CpuSample CpuSample::now() {
+  CpuSample sample;
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  sample.wallNs = toNanos(ts);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  sample.cpuNs = toNanos(ts);
+#ifdef RUSAGE_THREAD
+  rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+    sample.voluntarySwitches = usage.ru_nvcsw;
+    sample.involuntarySwitches = usage.ru_nivcsw;
+  }
+#endif
+  return sample;
+}
+
+std::vector<std::pair<string, CpuTimeStats>> CpuTimeProfiler::methods() {
+  std::lock_guard<std::mutex> lock(statsMutex);
+  return sorted(methodStats());
+}
+
+std::vector<std::pair<string, CpuTimeStats>> CpuTimeProfiler::stages() {
+  std::lock_guard<std::mutex> lock(statsMutex);
+  return sorted(stageStats());
+}
+
+void CpuTimeProfiler::reset() {
+  std::lock_guard<std::mutex> lock(statsMutex);
+  methodStats().clear();
+  stageStats().clear();
+}
+
+string CpuTimeProfiler::report() {
+  string text;
+  char line[160];
+  auto append = [&](const std::vector<std::pair<string, CpuTimeStats>> &rows, bool withStages) {
+    for (const auto &row : rows) {
+      const CpuTimeStats &s = row.second;
+      if (withStages) {
+        snprintf(line, sizeof(line),
+                 "%10llu calls cpu %9.3fms java %9.3fms marshal %9.3fms resolve %9.3fms "
+                 "off-cpu %9.3fms switches %lld/%lld  ",
+                 static_cast<unsigned long long>(s.calls), s.cpuNs / 1e6, s.javaCpuNs() / 1e6,
+                 s.marshalCpuNs / 1e6, s.resolveCpuNs / 1e6, s.offCpuNs() / 1e6,
+                 static_cast<long long>(s.voluntarySwitches),
+                 static_cast<long long>(s.involuntarySwitches));
+      } else {
+        snprintf(line, sizeof(line), "%10llu calls cpu %9.3fms off-cpu %9.3fms  ",
+                 static_cast<unsigned long long>(s.calls), s.cpuNs / 1e6, s.offCpuNs() / 1e6);
+      }
+      text += line;
+      text += row.first;
+      text += '\n';
+    }
+  };
+  text += "# methods\n";
+  append(methods(), true);
+  text += "# stages\n";
+  append(stages(), false);
+  return text;
+}
+
+// CpuCallScope
+
+void CpuCallScope::begin(const char *className, const char *method, const char *signature) {
+  active_ = true;
+  className_ = className;
+  method_ = method;
+  signature_ = signature;
+  parent_ = currentCall;
+  currentCall = this;
+  //a call made from inside a conversion starts its own stage nesting
+  parentStageDepth_ = stageDepth;
+  stageDepth = 0;
+  start_ = CpuSample::now();
+}
+
+void CpuCallScope::end() {
+  CpuSample end = CpuSample::now();
+  currentCall = parent_;
+  stageDepth = parentStageDepth_;
+  string key = className_ && className_[0] ? string(className_) + "." : string();
+  key += method_ ? method_ : "";
+  key += signature_ ? signature_ : "";
+  std::lock_guard<std::mutex> lock(statsMutex);
+  CpuTimeStats &stats = methodStats()[key];
+  accumulate(stats, start_, end);
+  stats.resolveCpuNs += resolveCpuNs_;
+  stats.marshalCpuNs += marshalCpuNs_;
+}
+
+// CpuStageScope
+
+void CpuStageScope::begin(CpuTimeProfiler::Stage stage, const char *kind) {
+  active_ = true;
+  outermost_ = stageDepth++ == 0;
+  stage_ = stage;
+  kind_ = kind;
+  start_ = CpuSample::now();
+}
+
+void CpuStageScope::end() {
+  CpuSample end = CpuSample::now();
+  stageDepth--;
+  if (outermost_ && currentCall) {
+    int64_t cpu = end.cpuNs - start_.cpuNs;
+    if (stage_ == CpuTimeProfiler::Stage::Resolve) {
+      currentCall->resolveCpuNs_ += cpu;
+    } else {
+      currentCall->marshalCpuNs_ += cpu;
+    }
+  }
+  std::lock_guard<std::mutex> lock(statsMutex);
+  accumulate(stageStats()[kind_], start_, end);
+}
+
+
+}
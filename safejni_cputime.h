@@ -0,0 +1,151 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace safejni {
+
+
+#pragma mark CPU Time Attribution
+
+//thread CPU time, wall time and context switches of the calling thread at one instant
+struct CpuSample {
+  int64_t wallNs = 0;
+  int64_t cpuNs = 0;
+  int64_t voluntarySwitches = 0;
+  int64_t involuntarySwitches = 0;
+
+  static CpuSample now();
+};
+
+//Aggregate for one java method descriptor or one conversion kind. For methods, cpuNs is
+//inclusive: resolveCpuNs and marshalCpuNs are the parts spent in method lookup and argument or
+//result conversion, the rest is the java side plus the JNI transition.
+struct CpuTimeStats {
+  uint64_t calls = 0;
+  int64_t wallNs = 0;
+  int64_t cpuNs = 0;
+  int64_t resolveCpuNs = 0;
+  int64_t marshalCpuNs = 0;
+  int64_t voluntarySwitches = 0;
+  int64_t involuntarySwitches = 0;
+
+  int64_t javaCpuNs() const { return cpuNs - resolveCpuNs - marshalCpuNs; }
+
+  //wall time not spent on the cpu: blocked on locks, I/O or waiting to be scheduled
+  int64_t offCpuNs() const { return wallNs > cpuNs ? wallNs - cpuNs : 0; }
+};
+
+//Opt-in attribution of thread CPU time and context switches to each Call/CallStatic/NewObject
+//and each conversion stage. Disabled it costs one relaxed load per scope; enabled it costs a
+//few clock_gettime/getrusage syscalls per scope plus a mutex to aggregate, so keep it for
+//profiling runs.
+class CpuTimeProfiler {
+public:
+  enum class Stage {
+    Resolve,
+    Marshal
+  };
+
+  static void setEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  //keyed by "class.method(signature)", class is empty for Call with a jclass
+  static std::vector<std::pair<std::string, CpuTimeStats>> methods();
+
+  //keyed by conversion or lookup kind ("toString", "resolve", ...)
+  static std::vector<std::pair<std::string, CpuTimeStats>> stages();
+
+  static void reset();
+
+  //one line per method, sorted by cpu time, then the stages
+  static std::string report();
+
+private:
+  friend class CpuCallScope;
+  friend class CpuStageScope;
+
+  static std::atomic<bool> enabled_;
+};
+
+//measures one java invocation, nested scopes on the same thread attribute their stages to it
+class CpuCallScope {
+public:
+  CpuCallScope(const char *className, const char *method, const char *signature) {
+    if (CpuTimeProfiler::enabled()) {
+      begin(className, method, signature);
+    }
+  }
+
+  ~CpuCallScope() {
+    if (active_) {
+      end();
+    }
+  }
+
+  CpuCallScope(const CpuCallScope &) = delete;
+
+  CpuCallScope &operator=(const CpuCallScope &) = delete;
+
+private:
+  friend class CpuStageScope;
+
+  void begin(const char *className, const char *method, const char *signature);
+
+  void end();
+
+  bool active_ = false;
+  const char *className_ = nullptr;
+  const char *method_ = nullptr;
+  const char *signature_ = nullptr;
+  CpuSample start_;
+  int64_t resolveCpuNs_ = 0;
+  int64_t marshalCpuNs_ = 0;
+  CpuCallScope *parent_ = nullptr;
+  int parentStageDepth_ = 0;
+};
+
+//measures a lookup or conversion; only the outermost stage is charged to the enclosing call
+class CpuStageScope {
+public:
+  CpuStageScope(CpuTimeProfiler::Stage stage, const char *kind) {
+    if (CpuTimeProfiler::enabled()) {
+      begin(stage, kind);
+    }
+  }
+
+  ~CpuStageScope() {
+    if (active_) {
+      end();
+    }
+  }
+
+  CpuStageScope(const CpuStageScope &) = delete;
+
+  CpuStageScope &operator=(const CpuStageScope &) = delete;
+
+private:
+  void begin(CpuTimeProfiler::Stage stage, const char *kind);
+
+  void end();
+
+  bool active_ = false;
+  bool outermost_ = false;
+  CpuTimeProfiler::Stage stage_ = CpuTimeProfiler::Stage::Marshal;
+  const char *kind_ = nullptr;
+  CpuSample start_;
+};
+
+
+}
@@ -0,0 +1,142 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_critical.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+using std::string;
+
+namespace safejni {
+
+
+namespace {
+
+std::atomic<CriticalSite *> firstSite(nullptr);
+
+//publishes every site's hold times through StatsRegistry: one family at a time, each listing
+//all sites, as a summary plus the max and over budget counts
+const int criticalCollector = StatsRegistry::shared().addCollector([](std::vector<MetricSample> &out) {
+  static const double quantiles[] = {50, 99, 99.9};
+  static const char *const quantileNames[] = {"0.5", "0.99", "0.999"};
+  auto label = [](const CriticalSite *site) { return string("{site=\"") + site->name() + "\""; };
+  for (CriticalSite *site = CriticalSite::first(); site; site = site->next()) {
+    for (int i = 0; i < 3; ++i) {
+      out.push_back({"safejni_critical_hold_nanos" + label(site) + ",quantile=\"" + quantileNames[i] + "\"}",
+                     static_cast<int64_t>(site->holdTimes().percentile(quantiles[i])), false, "summary"});
+    }
+  }
+  for (CriticalSite *site = CriticalSite::first(); site; site = site->next()) {
+    out.push_back({"safejni_critical_hold_nanos_sum" + label(site) + "}",
+                   static_cast<int64_t>(site->holdTimes().sum()), true, "summary"});
+  }
+  for (CriticalSite *site = CriticalSite::first(); site; site = site->next()) {
+    out.push_back({"safejni_critical_hold_nanos_count" + label(site) + "}",
+                   static_cast<int64_t>(site->holdTimes().count()), true, "summary"});
+  }
+  for (CriticalSite *site = CriticalSite::first(); site; site = site->next()) {
+    out.push_back({"safejni_critical_hold_nanos_max" + label(site) + "}",
+                   static_cast<int64_t>(site->holdTimes().max()), false});
+  }
+  for (CriticalSite *site = CriticalSite::first(); site; site = site->next()) {
+    out.push_back({"safejni_critical_over_budget_total" + label(site) + "}",
+                   static_cast<int64_t>(site->overBudget()), true});
+  }
+});
+
+std::mutex handlerMutex;
+
+void defaultViolationHandler(const CriticalSite &site, uint64_t holdNanos) {
+  fprintf(stderr, "[SafeJNI] critical section at %s held for %llu ns (budget %llu ns)\n",
+          site.name(), (unsigned long long) holdNanos,
+          (unsigned long long) CriticalWatchdog::budgetNanos());
+#ifndef NDEBUG
+  abort();
+#endif
+}
+
+CriticalWatchdog::ViolationHandler &violationHandler() {
+  static CriticalWatchdog::ViolationHandler handler(defaultViolationHandler);
+  return handler;
+}
+
+}
+
+// CriticalSite
+
+CriticalSite::CriticalSite(const char *name) : name_(name) {
+  CriticalSite *head = firstSite.load(std::memory_order_relaxed);
+  do {
+    next_ = head;
+  } while (!firstSite.compare_exchange_weak(head, this, std::memory_order_release,
+                                            std::memory_order_relaxed));
+}
+
+CriticalSite *CriticalSite::first() {
+  return firstSite.load(std::memory_order_acquire);
+}
+
+void CriticalSite::record(uint64_t holdNanos) {
+  holdTimes_.record(holdNanos);
+  if (holdNanos > CriticalWatchdog::budgetNanos()) {
+    overBudget_.fetch_add(1, std::memory_order_relaxed);
+    CriticalWatchdog::violation(*this, holdNanos);
+  }
+}
+
+// CriticalWatchdog
+
+std::atomic<uint64_t> CriticalWatchdog::budgetNanos_(1000000);
+
+void CriticalWatchdog::setBudget(std::chrono::nanoseconds budget) {
+  budgetNanos_.store(static_cast<uint64_t>(budget.count()), std::memory_order_relaxed);
+}
+
+void CriticalWatchdog::setViolationHandler(ViolationHandler handler) {
+  std::lock_guard<std::mutex> lock(handlerMutex);
+  violationHandler() = handler ? std::move(handler) : ViolationHandler(defaultViolationHandler);
+}
+
+void CriticalWatchdog::violation(const CriticalSite &site, uint64_t holdNanos) {
+  ViolationHandler handler;
+  {
+    std::lock_guard<std::mutex> lock(handlerMutex);
+    handler = violationHandler();
+  }
+  handler(site, holdNanos);
+}
+
+// CriticalStringGuard
+
+CriticalStringGuard::CriticalStringGuard(JNIEnv *env, jstring string, CriticalSite &site)
+        : env_(env), string_(string), site_(site) {
+  length_ = env_->GetStringLength(string_);
+  data_ = env_->GetStringCritical(string_, nullptr);
+  if (!data_) {
+    Tools::checkException(env_);
+    throw JNIException("GetStringCritical failed");
+  }
+  start_ = LatencyHistogram::nowNanos();
+}
+
+CriticalStringGuard::~CriticalStringGuard() {
+  release();
+}
+
+void CriticalStringGuard::release() {
+  if (!data_) {
+    return;
+  }
+  env_->ReleaseStringCritical(string_, data_);
+  data_ = nullptr;
+  site_.record(LatencyHistogram::nowNanos() - start_);
+}
+
+
+}
@@ -0,0 +1,62 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+#include "safejni_critical_site.h"
+
+
+namespace safejni {
+
+
+#pragma mark Critical Region Guards
+
+//GetStringCritical counterpart of CriticalArrayGuard
+class CriticalStringGuard {
+public:
+  CriticalStringGuard(JNIEnv *env, jstring string, CriticalSite &site);
+
+  ~CriticalStringGuard();
+
+  CriticalStringGuard(const CriticalStringGuard &) = delete;
+
+  CriticalStringGuard &operator=(const CriticalStringGuard &) = delete;
+
+  const jchar *data() const { return data_; }
+
+  jsize length() const { return length_; }
+
+  void release();
+
+private:
+  JNIEnv *env_;
+  jstring string_;
+  CriticalSite &site_;
+  const jchar *data_;
+  jsize length_;
+  uint64_t start_;
+};
+
+//Walks [offset, offset + count) of a big array in chunks of at most chunkElements, pinning each
+//chunk separately so the GC can run between them. fn(ElementType *chunk, jsize chunkOffset,
+//jsize chunkCount) must not call into JNI; with write = true its changes are committed.
+template<typename A, typename F>
+void processCriticalChunks(JNIEnv *env, A array, jsize offset, jsize count, jsize chunkElements,
+                           CriticalSite &site, F fn, bool write = false) {
+  checkArrayBounds(env, array, offset, count);
+  if (chunkElements <= 0) {
+    throw JNIException("processCriticalChunks: chunk size must be positive");
+  }
+  for (jsize done = 0; done < count; done += chunkElements) {
+    jsize length = count - done < chunkElements ? count - done : chunkElements;
+    CriticalArrayGuard<A> guard(env, array, site, write);
+    fn(guard.data() + offset + done, offset + done, length);
+  }
+}
+
+
+}
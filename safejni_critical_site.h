@@ -0,0 +1,91 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni_histogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+
+namespace safejni {
+
+
+#pragma mark Critical Region Watchdog
+
+//A place in the code that pins java memory with Get*Critical. Sites are meant to be statics
+//(see SAFEJNI_CRITICAL_SITE) and link themselves into a global list for reporting; their hold
+//times are exported through StatsRegistry as safejni_critical_* metrics labelled by site.
+class CriticalSite {
+public:
+  explicit CriticalSite(const char *name);
+
+  CriticalSite(const CriticalSite &) = delete;
+
+  CriticalSite &operator=(const CriticalSite &) = delete;
+
+  const char *name() const { return name_; }
+
+  const LatencyHistogram &holdTimes() const { return holdTimes_; }
+
+  uint64_t overBudget() const { return overBudget_.load(std::memory_order_relaxed); }
+
+  void record(uint64_t holdNanos);
+
+  //first registered site, iterate with next()
+  static CriticalSite *first();
+
+  CriticalSite *next() const { return next_; }
+
+private:
+  const char *name_;
+  LatencyHistogram holdTimes_;
+  std::atomic<uint64_t> overBudget_{0};
+  CriticalSite *next_ = nullptr;
+};
+
+//a function local static site named after the source location
+#define SAFEJNI_CRITICAL_SITE_STR2(x) #x
+#define SAFEJNI_CRITICAL_SITE_STR(x) SAFEJNI_CRITICAL_SITE_STR2(x)
+#define SAFEJNI_CRITICAL_SITE() \
+  ([]() -> safejni::CriticalSite & { \
+    static safejni::CriticalSite site(__FILE__ ":" SAFEJNI_CRITICAL_SITE_STR(__LINE__)); \
+    return site; \
+  }())
+
+class CriticalWatchdog {
+public:
+  typedef std::function<void(const CriticalSite &site, uint64_t holdNanos)> ViolationHandler;
+
+  //hold time above which a critical section counts as over budget (default 1ms)
+  static void setBudget(std::chrono::nanoseconds budget);
+
+  static uint64_t budgetNanos() { return budgetNanos_.load(std::memory_order_relaxed); }
+
+  //default: log, and abort in debug builds (NDEBUG undefined)
+  static void setViolationHandler(ViolationHandler handler);
+
+  static void violation(const CriticalSite &site, uint64_t holdNanos);
+
+private:
+  static std::atomic<uint64_t> budgetNanos_;
+};
+
+//sites of safejni's own pins, shared by every element type of fill / readInto
+inline CriticalSite &fillCriticalSite() {
+  static CriticalSite site("safejni::fill");
+  return site;
+}
+
+inline CriticalSite &readIntoCriticalSite() {
+  static CriticalSite site("safejni::readInto");
+  return site;
+}
+
+
+}
@@ -0,0 +1,168 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_dispatch.h"
+
+using std::string;
+
+namespace safejni {
+
+
+CoalescingDispatcher::CoalescingDispatcher(JNIEnv *env, jclass target, const char *methodName) {
+  resolve(env, target, methodName);
+}
+
+CoalescingDispatcher::CoalescingDispatcher(JNIEnv *env, const string &className,
+                                           const char *methodName) {
+  jclass target = env->FindClass(className.c_str());
+  Tools::checkException(env);
+  if (!target) {
+    throw JNIException(string("Could not find the given class: ") + className);
+  }
+  resolve(env, target, methodName);
+  env->DeleteLocalRef(target);
+}
+
+CoalescingDispatcher::~CoalescingDispatcher() {
+  stop();
+  if (target_) {
+    Tools::attachJniEnv()->DeleteGlobalRef(target_);
+  }
+}
+
+void CoalescingDispatcher::resolve(JNIEnv *env, jclass target, const char *methodName) {
+  method_ = env->GetStaticMethodID(target, methodName, "([I[I[D)V");
+  Tools::checkException(env);
+  if (!method_) {
+    throw JNIException(string("Could not find the given '") + methodName +
+                       "' static method using the '([I[I[D)V' signature.");
+  }
+  target_ = static_cast<jclass>(env->NewGlobalRef(target));
+}
+
+void CoalescingDispatcher::setPolicy(int key, Policy policy, size_t maxBatch) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Slot &slot = slots_[key];
+  slot.policy = policy;
+  slot.maxBatch = maxBatch ? maxBatch : 1;
+}
+
+void CoalescingDispatcher::post(int key, double value) {
+  stats_.posted.fetch_add(1, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Slot &slot = slots_[key];
+  if (!slot.pending) {
+    slot.pending = true;
+    slot.values.clear();
+    slot.head = 0;
+    slot.values.push_back(value);
+    pendingKeys_.push_back(key);
+    return;
+  }
+  stats_.coalesced.fetch_add(1, std::memory_order_relaxed);
+  switch (slot.policy) {
+    case Policy::LatestWins:
+      slot.values[0] = value;
+      break;
+    case Policy::Accumulate:
+      slot.values[0] += value;
+      break;
+    case Policy::Batch:
+      //a full batch is a ring: overwrite the oldest value in place
+      if (slot.values.size() >= slot.maxBatch) {
+        slot.values[slot.head] = value;
+        slot.head = (slot.head + 1) % slot.values.size();
+        stats_.dropped.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        slot.values.push_back(value);
+      }
+      break;
+  }
+}
+
+size_t CoalescingDispatcher::flush() {
+  std::lock_guard<std::mutex> flushLock(flushMutex_);
+  flushKeys_.clear();
+  flushOffsets_.clear();
+  flushValues_.clear();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int key : pendingKeys_) {
+      Slot &slot = slots_[key];
+      flushKeys_.push_back(key);
+      flushOffsets_.push_back(static_cast<jint>(flushValues_.size()));
+      //oldest first
+      flushValues_.insert(flushValues_.end(), slot.values.begin() + slot.head, slot.values.end());
+      flushValues_.insert(flushValues_.end(), slot.values.begin(), slot.values.begin() + slot.head);
+      slot.pending = false;
+    }
+    pendingKeys_.clear();
+  }
+  if (flushKeys_.empty()) {
+    return 0;
+  }
+  flushOffsets_.push_back(static_cast<jint>(flushValues_.size()));
+
+  JNIEnv *env = Tools::attachJniEnv();
+  jsize keyCount = static_cast<jsize>(flushKeys_.size());
+  jintArray keys = env->NewIntArray(keyCount);
+  jintArray offsets = env->NewIntArray(keyCount + 1);
+  jdoubleArray values = env->NewDoubleArray(static_cast<jsize>(flushValues_.size()));
+  Tools::checkException(env);
+  env->SetIntArrayRegion(keys, 0, keyCount, flushKeys_.data());
+  env->SetIntArrayRegion(offsets, 0, keyCount + 1, flushOffsets_.data());
+  env->SetDoubleArrayRegion(values, 0, static_cast<jsize>(flushValues_.size()), flushValues_.data());
+  env->CallStaticVoidMethod(target_, method_, keys, offsets, values);
+  env->DeleteLocalRef(keys);
+  env->DeleteLocalRef(offsets);
+  env->DeleteLocalRef(values);
+  stats_.flushes.fetch_add(1, std::memory_order_relaxed);
+  stats_.delivered.fetch_add(flushValues_.size(), std::memory_order_relaxed);
+  Tools::checkException(env);
+  return flushKeys_.size();
+}
+
+void CoalescingDispatcher::start(std::chrono::milliseconds interval) {
+  stop();
+  timerStopping_ = false;
+  timer_ = std::thread(&CoalescingDispatcher::timerLoop, this, interval);
+}
+
+void CoalescingDispatcher::stop() {
+  if (!timer_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(timerMutex_);
+    timerStopping_ = true;
+  }
+  timerWake_.notify_all();
+  timer_.join();
+}
+
+void CoalescingDispatcher::timerLoop(std::chrono::milliseconds interval) {
+  Tools::attachJniEnv();
+  std::unique_lock<std::mutex> lock(timerMutex_);
+  while (!timerWake_.wait_for(lock, interval, [this] { return timerStopping_; })) {
+    lock.unlock();
+    try {
+      flush();
+    } catch (const JNIException &) {
+      //logged by JNIException, keep the timer alive
+    }
+    lock.lock();
+  }
+  lock.unlock();
+  try {
+    flush();
+  } catch (const JNIException &) {
+  }
+  Tools::detachJniEnv();
+}
+
+
+}
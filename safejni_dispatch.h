@@ -0,0 +1,105 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+
+namespace safejni {
+
+
+#pragma mark Coalescing Dispatcher
+
+//Collects high frequency keyed updates and delivers them to java in one static call per flush:
+//  static void <method>(int[] keys, int[] offsets, double[] values)
+//The values of keys[i] are values[offsets[i] .. offsets[i + 1]), offsets has keys.length + 1 items.
+class CoalescingDispatcher {
+public:
+  enum class Policy {
+    LatestWins,   //only the last value posted since the previous flush
+    Accumulate,   //the sum of the values posted since the previous flush
+    Batch         //every value, up to maxBatch per key (older values are dropped)
+  };
+
+  struct Stats {
+    std::atomic<uint64_t> posted{0};
+    std::atomic<uint64_t> coalesced{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> flushes{0};
+    std::atomic<uint64_t> delivered{0};
+  };
+
+  //the class must be reachable from the calling thread, e.g. resolve it in JNI_OnLoad
+  CoalescingDispatcher(JNIEnv *env, jclass target, const char *methodName);
+
+  CoalescingDispatcher(JNIEnv *env, const std::string &className, const char *methodName);
+
+  ~CoalescingDispatcher();
+
+  CoalescingDispatcher(const CoalescingDispatcher &) = delete;
+
+  CoalescingDispatcher &operator=(const CoalescingDispatcher &) = delete;
+
+  //keys without an explicit policy use LatestWins
+  void setPolicy(int key, Policy policy, size_t maxBatch = 1024);
+
+  void post(int key, double value);
+
+  //delivers everything pending with a single java call, returns the number of keys delivered
+  size_t flush();
+
+  //flushes from an attached background thread every `interval`
+  void start(std::chrono::milliseconds interval);
+
+  void stop();
+
+  const Stats &stats() const { return stats_; }
+
+private:
+  struct Slot {
+    Policy policy = Policy::LatestWins;
+    size_t maxBatch = 1024;
+    bool pending = false;
+    std::vector<double> values;
+    //oldest value once a batch has wrapped around maxBatch
+    size_t head = 0;
+  };
+
+  void resolve(JNIEnv *env, jclass target, const char *methodName);
+
+  void timerLoop(std::chrono::milliseconds interval);
+
+  jclass target_ = nullptr;
+  jmethodID method_ = nullptr;
+
+  std::mutex mutex_;
+  std::unordered_map<int, Slot> slots_;
+  std::vector<int> pendingKeys_;
+
+  //flush builds its arrays here so steady state flushing does not allocate natively
+  std::mutex flushMutex_;
+  std::vector<jint> flushKeys_;
+  std::vector<jint> flushOffsets_;
+  std::vector<jdouble> flushValues_;
+
+  std::thread timer_;
+  std::mutex timerMutex_;
+  std::condition_variable timerWake_;
+  bool timerStopping_ = false;
+
+  Stats stats_;
+};
+
+
+}
@@ -0,0 +1,95 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_executor.h"
+
+namespace safejni {
+
+
+JvmThreadExecutor::JvmThreadExecutor(size_t maxBatch) : maxBatch_(maxBatch ? maxBatch : 1) {
+  std::promise<void> started;
+  std::future<void> ready = started.get_future();
+  thread_ = std::thread([this, &started] {
+    env_ = Tools::attachJniEnv();
+    threadId_ = std::this_thread::get_id();
+    started.set_value();
+    threadLoop();
+  });
+  ready.wait();
+}
+
+JvmThreadExecutor::~JvmThreadExecutor() {
+  stopping_.store(true);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+void JvmThreadExecutor::post(std::function<void(JNIEnv *)> fn) {
+  if (isCurrentThread()) {
+    //posting from the executor thread still defers, but skips the wakeup
+    Task task;
+    task.fn = std::move(fn);
+    task.enqueued = LatencyHistogram::nowNanos();
+    queue_.push(std::move(task));
+    stats_.posted.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  enqueue(std::move(fn));
+}
+
+void JvmThreadExecutor::enqueue(std::function<void(JNIEnv *)> fn) {
+  Task task;
+  task.fn = std::move(fn);
+  task.enqueued = LatencyHistogram::nowNanos();
+  queue_.push(std::move(task));
+  stats_.posted.fetch_add(1, std::memory_order_relaxed);
+  //pairs with the fence in threadLoop: either we see it sleeping or it sees our task
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_.notify_one();
+  }
+}
+
+void JvmThreadExecutor::threadLoop() {
+  Task task;
+  for (;;) {
+    size_t drained = 0;
+    while (drained < maxBatch_ && queue_.pop(task)) {
+      stats_.queueDelay.record(LatencyHistogram::nowNanos() - task.enqueued);
+      try {
+        task.fn(env_);
+      } catch (...) {
+        //JNIException already logs itself, post() has nobody to report to
+      }
+      Tools::clearException(env_);
+      task.fn = nullptr;
+      drained++;
+    }
+    if (drained) {
+      stats_.batches.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    if (stopping_.load()) {
+      break;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (queue_.empty() && !stopping_.load()) {
+      wake_.wait(lock);
+    }
+    sleeping_.store(false, std::memory_order_relaxed);
+  }
+  Tools::detachJniEnv();
+}
+
+
+}
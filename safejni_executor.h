@@ -0,0 +1,118 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+#include "safejni_histogram.h"
+#include "safejni_mpsc.h"
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+
+namespace safejni {
+
+
+#pragma mark JVM Thread Executor
+
+//Runs work on one dedicated attached thread, for java objects that must only be touched there.
+//Posting is lock free; the thread drains up to maxBatch tasks per wakeup. Calls made from the
+//executor thread itself (including nested invokeSync from inside a task) run inline instead of
+//queuing, which would otherwise deadlock.
+class JvmThreadExecutor {
+public:
+  struct Stats {
+    std::atomic<uint64_t> posted{0};
+    //invokeSync from the executor thread, run inline
+    std::atomic<uint64_t> inlineCalls{0};
+    //the subset made while another invokeSync call was running
+    std::atomic<uint64_t> reentrantCalls{0};
+    std::atomic<uint64_t> batches{0};
+    //post to start of execution
+    LatencyHistogram queueDelay;
+  };
+
+  explicit JvmThreadExecutor(size_t maxBatch = 64);
+
+  ~JvmThreadExecutor();
+
+  JvmThreadExecutor(const JvmThreadExecutor &) = delete;
+
+  JvmThreadExecutor &operator=(const JvmThreadExecutor &) = delete;
+
+  //fire and forget, exceptions thrown by fn are logged and swallowed
+  void post(std::function<void(JNIEnv *)> fn);
+
+  //runs fn(JNIEnv *) on the executor thread and returns its result (or rethrows its exception)
+  template<typename F>
+  auto invokeSync(F fn) -> decltype(fn(std::declval<JNIEnv *>())) {
+    typedef decltype(fn(std::declval<JNIEnv *>())) R;
+    if (isCurrentThread()) {
+      stats_.inlineCalls.fetch_add(1, std::memory_order_relaxed);
+      if (syncDepth_ > 0) {
+        stats_.reentrantCalls.fetch_add(1, std::memory_order_relaxed);
+      }
+      SyncScope scope(syncDepth_);
+      return fn(env_);
+    }
+    std::packaged_task<R(JNIEnv *)> task(std::move(fn));
+    std::future<R> future = task.get_future();
+    //packaged_task stores exceptions instead of throwing, the depth always unwinds
+    enqueue([this, &task](JNIEnv *env) {
+      SyncScope scope(syncDepth_);
+      task(env);
+    });
+    return future.get();
+  }
+
+  //object->Call<T>(methodName, v...) on the executor thread
+  template<typename T = void, typename... Args>
+  T invokeSync(const JNIObjectPtr &object, const std::string &methodName, Args... v) {
+    return invokeSync([&](JNIEnv *) { return object->Call<T>(methodName, v...); });
+  }
+
+  bool isCurrentThread() const { return std::this_thread::get_id() == threadId_; }
+
+  const Stats &stats() const { return stats_; }
+
+private:
+  struct Task {
+    std::function<void(JNIEnv *)> fn;
+    uint64_t enqueued = 0;
+  };
+
+  struct SyncScope {
+    explicit SyncScope(int &depth) : depth_(depth) { depth_++; }
+
+    ~SyncScope() { depth_--; }
+
+    int &depth_;
+  };
+
+  void enqueue(std::function<void(JNIEnv *)> fn);
+
+  void threadLoop();
+
+  size_t maxBatch_;
+  MpscQueue<Task> queue_;
+  std::atomic<bool> sleeping_{false};
+  std::atomic<bool> stopping_{false};
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread thread_;
+  std::thread::id threadId_;
+  JNIEnv *env_ = nullptr;
+  //invokeSync calls running on the executor thread, only touched there
+  int syncDepth_ = 0;
+  Stats stats_;
+};
+
+
+}
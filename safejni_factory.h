@@ -0,0 +1,198 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+
+#include <string>
+#include <vector>
+
+
+namespace safejni {
+
+
+#pragma mark Bulk Object Factory
+
+//Compile time descriptor of one record member, see SAFEJNI_JAVA_FIELD
+template<typename R, typename T, T R::*Member>
+struct JavaField {
+  typedef T Type;
+
+  static const T &get(const R &record) { return record.*Member; }
+
+  static const char *signature() {
+    return Concatenate<typename CPPToJNIConversor<T>::JNIType, CompileTimeString<'\0'>>::Result::value();
+  }
+};
+
+#define SAFEJNI_JAVA_FIELD(Record, member) \
+  safejni::JavaField<Record, decltype(Record::member), &Record::member>
+
+//Builds a java object array from native records. The class, the constructor or field ids are
+//resolved once per factory; each chunk of records runs under one local frame and only the
+//final array is handed back. Two ways to fill an object:
+//  - constructor: one constructor taking the fields in declaration order
+//  - fields: AllocObject (no constructor runs) plus one Set<Type>Field per named field
+//
+//  struct Point { int32_t x; int32_t y; std::string label; };
+//  JavaObjectFactory<Point, SAFEJNI_JAVA_FIELD(Point, x), SAFEJNI_JAVA_FIELD(Point, y),
+//                    SAFEJNI_JAVA_FIELD(Point, label)> factory(env, "com/example/Point");
+//  jobjectArray points = factory.build(env, records);
+template<typename Record, typename... Fields>
+class JavaObjectFactory {
+public:
+  static_assert(sizeof...(Fields) > 0, "JavaObjectFactory needs at least one field");
+
+  static constexpr uint8_t kFields = sizeof...(Fields);
+
+  //constructor mode, resolves <init> with the fields' signature
+  JavaObjectFactory(JNIEnv *env, const std::string &className, jsize chunkSize = 256)
+          : chunkSize_(chunkSize > 0 ? chunkSize : 256) {
+    resolveClass(env, className);
+    const char *signature = Concatenate<CompileTimeString<'('>,
+            typename CPPToJNIConversor<typename Fields::Type>::JNIType...,
+            CompileTimeString<')', 'V', '\0'>>::Result::value();
+    constructor_ = env->GetMethodID(class_, "<init>", signature);
+    Tools::checkException(env);
+    if (!constructor_) {
+      throw JNIException("JavaObjectFactory: no " + className + " constructor " + signature);
+    }
+  }
+
+  //fields mode, one java field name per descriptor in the same order
+  JavaObjectFactory(JNIEnv *env, const std::string &className,
+                    const std::vector<std::string> &fieldNames, jsize chunkSize = 256)
+          : chunkSize_(chunkSize > 0 ? chunkSize : 256) {
+    if (fieldNames.size() != kFields) {
+      throw JNIException("JavaObjectFactory: expected one field name per descriptor");
+    }
+    resolveClass(env, className);
+    const char *signatures[] = {Fields::signature()...};
+    for (size_t i = 0; i < kFields; ++i) {
+      fieldIds_[i] = env->GetFieldID(class_, fieldNames[i].c_str(), signatures[i]);
+      Tools::checkException(env);
+      if (!fieldIds_[i]) {
+        throw JNIException("JavaObjectFactory: no field " + className + "." + fieldNames[i]);
+      }
+    }
+  }
+
+  ~JavaObjectFactory() {
+    Tools::attachJniEnv()->DeleteGlobalRef(class_);
+  }
+
+  JavaObjectFactory(const JavaObjectFactory &) = delete;
+
+  JavaObjectFactory &operator=(const JavaObjectFactory &) = delete;
+
+  //a local ref to a new array holding one object per record
+  jobjectArray build(JNIEnv *env, const std::vector<Record> &records) const {
+    jsize count = static_cast<jsize>(records.size());
+    jobjectArray array = env->NewObjectArray(count, class_, nullptr);
+    Tools::checkException(env);
+    try {
+      for (jsize start = 0; start < count; start += chunkSize_) {
+        jsize end = count - start < chunkSize_ ? count : start + chunkSize_;
+        ChunkFrame frame(env, chunkSize_);
+        for (jsize i = start; i < end; ++i) {
+          jobject object = create(env, records[i]);
+          env->SetObjectArrayElement(array, i, object);
+          env->DeleteLocalRef(object);
+        }
+      }
+    } catch (...) {
+      env->DeleteLocalRef(array);
+      throw;
+    }
+    return array;
+  }
+
+  //build() wrapped like the JNIObjectPtr results of CallStatic/Call
+  JNIObjectPtr buildShared(const std::vector<Record> &records) const {
+    return JNIObject::CreateShared(build(Tools::attachJniEnv(), records));
+  }
+
+private:
+  //Push/PopLocalFrame around a chunk, popped on the way out of an exception too
+  class ChunkFrame {
+  public:
+    ChunkFrame(JNIEnv *env, jsize capacity) : env_(env) {
+      if (env_->PushLocalFrame(capacity) != 0) {
+        Tools::checkException(env_);
+        throw JNIException("JavaObjectFactory: could not reserve a local frame");
+      }
+    }
+
+    ~ChunkFrame() {
+      env_->PopLocalFrame(nullptr);
+    }
+
+  private:
+    JNIEnv *env_;
+  };
+
+  void resolveClass(JNIEnv *env, const std::string &className) {
+    jclass local = env->FindClass(className.c_str());
+    Tools::checkException(env);
+    if (!local) {
+      throw JNIException("JavaObjectFactory: could not find class " + className);
+    }
+    class_ = static_cast<jclass>(env->NewGlobalRef(local));
+    env->DeleteLocalRef(local);
+  }
+
+  jobject create(JNIEnv *env, const Record &record) const {
+    //converted object arguments are released by the destructor right after each record
+    JNIParamDestructor<kFields> destructor(env);
+    jobject object;
+    if (constructor_) {
+      object = env->NewObject(class_, constructor_,
+                              JNIParamConversor<typename Fields::Type>(env, Fields::get(record),
+                                                                       destructor)...);
+    } else {
+      object = env->AllocObject(class_);
+      if (object) {
+        int index = 0;
+        int expand[] = {0, (setField(env, object, fieldIds_[index++],
+                                     JNIParamConversor<typename Fields::Type>(
+                                             env, Fields::get(record), destructor)), 0)...};
+        (void) expand;
+      }
+    }
+    Tools::checkException(env);
+    if (!object) {
+      throw JNIException("JavaObjectFactory: object creation failed");
+    }
+    return object;
+  }
+
+  static void setField(JNIEnv *env, jobject o, jfieldID f, jboolean v) { env->SetBooleanField(o, f, v); }
+
+  static void setField(JNIEnv *env, jobject o, jfieldID f, jbyte v) { env->SetByteField(o, f, v); }
+
+  static void setField(JNIEnv *env, jobject o, jfieldID f, jchar v) { env->SetCharField(o, f, v); }
+
+  static void setField(JNIEnv *env, jobject o, jfieldID f, jshort v) { env->SetShortField(o, f, v); }
+
+  static void setField(JNIEnv *env, jobject o, jfieldID f, jint v) { env->SetIntField(o, f, v); }
+
+  static void setField(JNIEnv *env, jobject o, jfieldID f, jlong v) { env->SetLongField(o, f, v); }
+
+  static void setField(JNIEnv *env, jobject o, jfieldID f, jfloat v) { env->SetFloatField(o, f, v); }
+
+  static void setField(JNIEnv *env, jobject o, jfieldID f, jdouble v) { env->SetDoubleField(o, f, v); }
+
+  static void setField(JNIEnv *env, jobject o, jfieldID f, jobject v) { env->SetObjectField(o, f, v); }
+
+  jclass class_ = nullptr;
+  jmethodID constructor_ = nullptr;
+  jfieldID fieldIds_[kFields] = {};
+  jsize chunkSize_;
+};
+
+
+}
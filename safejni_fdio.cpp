@@ -0,0 +1,290 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_fdio.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <memory>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+using std::string;
+
+namespace safejni {
+
+
+namespace {
+
+FdIOStats fdIOStats;
+
+void account(FdIOResult &result, ssize_t bytes) {
+  result.syscalls++;
+  result.bytes += bytes;
+  fdIOStats.syscalls.fetch_add(1, std::memory_order_relaxed);
+  fdIOStats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+//publishes the fd I/O counters through StatsRegistry
+const int fdIOCollector = StatsRegistry::shared().addCollector([](std::vector<MetricSample> &out) {
+  out.push_back({"safejni_fdio_syscalls_total", static_cast<int64_t>(fdIOStats.syscalls.load()), true});
+  out.push_back({"safejni_fdio_bytes_total", static_cast<int64_t>(fdIOStats.bytes.load()), true});
+  out.push_back({"safejni_fdio_partial_transfers_total",
+                 static_cast<int64_t>(fdIOStats.partialTransfers.load()), true});
+});
+
+}
+
+JavaIOVec::JavaIOVec(JNIEnv *env) : env_(env) {
+
+}
+
+JavaIOVec::~JavaIOVec() {
+
+}
+
+void JavaIOVec::addDirectBuffer(jobject buffer, size_t offset, size_t length) {
+  auto *address = static_cast<uint8_t *>(env_->GetDirectBufferAddress(buffer));
+  jlong capacity = env_->GetDirectBufferCapacity(buffer);
+  if (!address || capacity < 0) {
+    throw JNIException("JavaIOVec: not a direct ByteBuffer");
+  }
+  size_t size = static_cast<size_t>(capacity);
+  if (offset > size) {
+    throw JNIException("JavaIOVec: direct buffer offset out of bounds");
+  }
+  if (length == 0) {
+    length = size - offset;
+  }
+  if (length > size - offset) {
+    throw JNIException("JavaIOVec: direct buffer range out of bounds");
+  }
+  iov_.push_back({address + offset, length});
+  total_ += length;
+}
+
+void JavaIOVec::addByteArray(jbyteArray array, jsize offset, jsize length) {
+  if (!array) {
+    throw JNIException("JavaIOVec: null byte array");
+  }
+  if (length < 0) {
+    length = env_->GetArrayLength(array) - offset;
+  }
+  checkArrayBounds(env_, array, offset, length);
+  arrays_.push_back({array, offset, iov_.size()});
+  iov_.push_back({nullptr, static_cast<size_t>(length)});
+  total_ += length;
+}
+
+FdIOResult JavaIOVec::writeTo(int fd) {
+  return transfer(fd, true);
+}
+
+FdIOResult JavaIOVec::readFrom(int fd) {
+  return transfer(fd, false);
+}
+
+namespace {
+
+//critical pins for the byte[] segments of one syscall, released on every exit path
+class CriticalPins {
+public:
+  CriticalPins(JNIEnv *env, bool write) : env_(env), write_(write) {}
+
+  ~CriticalPins() {
+    while (!pins_.empty()) {
+      pins_.pop_back();
+    }
+  }
+
+  jbyte *pin(jbyteArray array) {
+    //reads must copy back if the VM handed us a copy, writes can skip it
+    std::unique_ptr<CriticalArrayGuard<jbyteArray>> guard(new CriticalArrayGuard<jbyteArray>(
+            env_, array, SAFEJNI_CRITICAL_SITE(), !write_, std::nothrow));
+    jbyte *elements = guard->data();
+    if (elements) {
+      pins_.push_back(std::move(guard));
+    }
+    return elements;
+  }
+
+private:
+  JNIEnv *env_;
+  bool write_;
+  std::vector<std::unique_ptr<CriticalArrayGuard<jbyteArray>>> pins_;
+};
+
+}
+
+FdIOResult JavaIOVec::transfer(int fd, bool write) {
+  FdIOResult result;
+  //critical pins hold off every GC in the VM, so they only ever span one syscall that cannot
+  //block; on a blocking descriptor the byte[] regions are staged in a native buffer instead
+  int flags = fcntl(fd, F_GETFL);
+  bool pinArrays = flags >= 0 && (flags & O_NONBLOCK) != 0;
+  std::vector<jbyte> staging;
+  std::vector<size_t> stagingOffsets;
+  if (!pinArrays && !arrays_.empty()) {
+    for (const ArraySegment &segment : arrays_) {
+      stagingOffsets.push_back(staging.size());
+      staging.resize(staging.size() + iov_[segment.index].iov_len);
+    }
+    if (write) {
+      for (size_t a = 0; a < arrays_.size(); ++a) {
+        env_->GetByteArrayRegion(arrays_[a].array, arrays_[a].offset,
+                                 static_cast<jsize>(iov_[arrays_[a].index].iov_len),
+                                 staging.data() + stagingOffsets[a]);
+      }
+      Tools::checkException(env_);
+    }
+  }
+  //bytes already moved per segment, pinned bases may change between syscalls
+  std::vector<size_t> moved(iov_.size(), 0);
+  //copies what readv put in the staging buffer back into the arrays
+  auto unstage = [&] {
+    if (write || staging.empty()) {
+      return;
+    }
+    for (size_t a = 0; a < arrays_.size(); ++a) {
+      size_t filled = moved[arrays_[a].index];
+      if (filled) {
+        env_->SetByteArrayRegion(arrays_[a].array, arrays_[a].offset, static_cast<jsize>(filled),
+                                 staging.data() + stagingOffsets[a]);
+      }
+    }
+    Tools::checkException(env_);
+  };
+
+  std::vector<struct iovec> batch;
+  size_t index = 0;
+  while (index < iov_.size() && iov_[index].iov_len == 0) {
+    index++;
+  }
+  while (index < iov_.size()) {
+    size_t count = std::min<size_t>(iov_.size() - index, IOV_MAX);
+    ssize_t done;
+    int err;
+    {
+      CriticalPins pins(env_, write);
+      batch.assign(iov_.begin() + index, iov_.begin() + index + count);
+      for (size_t a = 0; a < arrays_.size(); ++a) {
+        const ArraySegment &segment = arrays_[a];
+        if (segment.index < index || segment.index >= index + count) {
+          continue;
+        }
+        jbyte *base;
+        if (pinArrays) {
+          base = pins.pin(segment.array);
+          if (!base) {
+            throw JNIException("JavaIOVec: could not pin byte array");
+          }
+          base += segment.offset;
+        } else {
+          base = staging.data() + stagingOffsets[a];
+        }
+        batch[segment.index - index].iov_base = base;
+      }
+      for (size_t i = 0; i < count; ++i) {
+        batch[i].iov_base = static_cast<uint8_t *>(batch[i].iov_base) + moved[index + i];
+        batch[i].iov_len -= moved[index + i];
+      }
+      done = write ? ::writev(fd, batch.data(), static_cast<int>(count))
+                   : ::readv(fd, batch.data(), static_cast<int>(count));
+      //releasing the pins may clobber errno
+      err = errno;
+    }
+    if (done < 0) {
+      if (err == EINTR) {
+        continue;
+      }
+      if (err == EAGAIN || err == EWOULDBLOCK) {
+        fdIOStats.partialTransfers.fetch_add(1, std::memory_order_relaxed);
+        unstage();
+        return result;
+      }
+      throw JNIException(string(write ? "writev" : "readv") + " failed: " + strerror(err));
+    }
+    account(result, done);
+    if (done == 0) {
+      //EOF on read
+      fdIOStats.partialTransfers.fetch_add(1, std::memory_order_relaxed);
+      unstage();
+      return result;
+    }
+    size_t left = static_cast<size_t>(done);
+    while (index < iov_.size() && left >= iov_[index].iov_len - moved[index]) {
+      left -= iov_[index].iov_len - moved[index];
+      moved[index] = iov_[index].iov_len;
+      index++;
+    }
+    if (left > 0) {
+      moved[index] += left;
+    }
+  }
+  unstage();
+  result.complete = true;
+  return result;
+}
+
+const FdIOStats &JavaIOVec::stats() {
+  return fdIOStats;
+}
+
+FdIOResult sendFile(int outFd, int inFd, off_t offset, size_t count) {
+  FdIOResult result;
+  while (result.bytes < count) {
+    ssize_t done = ::sendfile(outFd, inFd, &offset, count - result.bytes);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        fdIOStats.partialTransfers.fetch_add(1, std::memory_order_relaxed);
+        return result;
+      }
+      throw JNIException(string("sendfile failed: ") + strerror(errno));
+    }
+    if (done == 0) {
+      return result;
+    }
+    account(result, done);
+  }
+  result.complete = true;
+  return result;
+}
+
+FdIOResult spliceFd(int inFd, int outFd, size_t count) {
+  FdIOResult result;
+  while (result.bytes < count) {
+    ssize_t done = ::splice(inFd, nullptr, outFd, nullptr, count - result.bytes, SPLICE_F_MOVE);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        fdIOStats.partialTransfers.fetch_add(1, std::memory_order_relaxed);
+        return result;
+      }
+      throw JNIException(string("splice failed: ") + strerror(errno));
+    }
+    if (done == 0) {
+      return result;
+    }
+    account(result, done);
+  }
+  result.complete = true;
+  return result;
+}
+
+
+}
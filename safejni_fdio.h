@@ -0,0 +1,94 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+
+#include <atomic>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+namespace safejni {
+
+
+#pragma mark Scatter Gather File Descriptor IO
+
+struct FdIOResult {
+  size_t bytes = 0;
+  size_t syscalls = 0;
+  //false when the descriptor would block or the peer hit EOF before every segment was done
+  bool complete = false;
+};
+
+struct FdIOStats {
+  std::atomic<uint64_t> syscalls{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> partialTransfers{0};
+
+  double bytesPerSyscall() const {
+    uint64_t calls = syscalls.load(std::memory_order_relaxed);
+    return calls ? static_cast<double>(bytes.load(std::memory_order_relaxed)) / calls : 0.0;
+  }
+};
+
+//Gathers java buffers into an iovec list for writev/readv. Direct ByteBuffers are used in place.
+//byte[] regions are pinned with GetPrimitiveArrayCritical around each single syscall when the
+//descriptor is non-blocking; on a blocking descriptor, where a syscall could hold off the GC for
+//as long as the peer stalls, they are staged through a native copy instead.
+class JavaIOVec {
+public:
+  explicit JavaIOVec(JNIEnv *env);
+
+  ~JavaIOVec();
+
+  JavaIOVec(const JavaIOVec &) = delete;
+
+  JavaIOVec &operator=(const JavaIOVec &) = delete;
+
+  //zero length means up to the buffer capacity
+  void addDirectBuffer(jobject buffer, size_t offset = 0, size_t length = 0);
+
+  //negative length means up to the end of the array
+  void addByteArray(jbyteArray array, jsize offset = 0, jsize length = -1);
+
+  //writev until every segment is written, EAGAIN stops early with complete = false
+  FdIOResult writeTo(int fd);
+
+  //readv until every segment is filled, EOF or EAGAIN stop early with complete = false
+  FdIOResult readFrom(int fd);
+
+  size_t totalBytes() const { return total_; }
+
+  size_t segments() const { return iov_.size(); }
+
+  static const FdIOStats &stats();
+
+private:
+  struct ArraySegment {
+    jbyteArray array;
+    jsize offset;
+    //entry of iov_ whose base is filled in while the array is pinned
+    size_t index;
+  };
+
+  FdIOResult transfer(int fd, bool write);
+
+  JNIEnv *env_;
+  std::vector<struct iovec> iov_;
+  std::vector<ArraySegment> arrays_;
+  size_t total_ = 0;
+};
+
+//zero-copy file to descriptor transfer through sendfile, loops over partial transfers
+FdIOResult sendFile(int outFd, int inFd, off_t offset, size_t count);
+
+//moves up to `count` bytes between descriptors through splice (one end must be a pipe)
+FdIOResult spliceFd(int inFd, int outFd, size_t count);
+
+
+}
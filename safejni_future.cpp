@@ -0,0 +1,122 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_future.h"
+
+namespace safejni {
+
+
+namespace {
+
+//CompletableFuture is a boot class, its method ids stay valid for the life of the VM
+struct FutureMethods {
+  jclass futureClass;
+  jmethodID constructor;
+  jmethodID whenComplete;
+  jmethodID complete;
+  jmethodID completeExceptionally;
+  jclass completionException;
+  jmethodID getCause;
+  jmethodID toString;
+  jclass runtimeException;
+  jmethodID runtimeExceptionConstructor;
+
+  explicit FutureMethods(JNIEnv *env) {
+    futureClass = globalClass(env, "java/util/concurrent/CompletableFuture");
+    constructor = env->GetMethodID(futureClass, "<init>", "()V");
+    whenComplete = env->GetMethodID(futureClass, "whenComplete",
+                                    "(Ljava/util/function/BiConsumer;)Ljava/util/concurrent/CompletableFuture;");
+    complete = env->GetMethodID(futureClass, "complete", "(Ljava/lang/Object;)Z");
+    completeExceptionally = env->GetMethodID(futureClass, "completeExceptionally",
+                                             "(Ljava/lang/Throwable;)Z");
+    completionException = globalClass(env, "java/util/concurrent/CompletionException");
+    jclass throwable = env->FindClass("java/lang/Throwable");
+    getCause = env->GetMethodID(throwable, "getCause", "()Ljava/lang/Throwable;");
+    toString = env->GetMethodID(throwable, "toString", "()Ljava/lang/String;");
+    env->DeleteLocalRef(throwable);
+    runtimeException = globalClass(env, "java/lang/RuntimeException");
+    runtimeExceptionConstructor = env->GetMethodID(runtimeException, "<init>", "(Ljava/lang/String;)V");
+    Tools::checkException(env);
+  }
+
+  static jclass globalClass(JNIEnv *env, const char *name) {
+    jclass local = env->FindClass(name);
+    Tools::checkException(env);
+    jclass global = static_cast<jclass>(env->NewGlobalRef(local));
+    env->DeleteLocalRef(local);
+    return global;
+  }
+};
+
+const FutureMethods &futureMethods(JNIEnv *env) {
+  static FutureMethods methods(env);
+  return methods;
+}
+
+}
+
+void whenComplete(JNIEnv *env, jobject completableFuture, CallableRegistry::Invoker invoker) {
+  const FutureMethods &methods = futureMethods(env);
+  JNIObjectPtr callback = NativeCallable::Create(std::move(invoker), true);
+  jobject stage = env->CallObjectMethod(completableFuture, methods.whenComplete, callback->instance);
+  Tools::checkException(env);
+  if (stage) {
+    env->DeleteLocalRef(stage);
+  }
+}
+
+std::string describeThrowable(JNIEnv *env, jobject throwable) {
+  const FutureMethods &methods = futureMethods(env);
+  jobject error = env->NewLocalRef(throwable);
+  while (env->IsInstanceOf(error, methods.completionException)) {
+    jobject cause = env->CallObjectMethod(error, methods.getCause);
+    if (!cause) {
+      break;
+    }
+    env->DeleteLocalRef(error);
+    error = cause;
+  }
+  jstring text = static_cast<jstring>(env->CallObjectMethod(error, methods.toString));
+  env->DeleteLocalRef(error);
+  std::string message = Tools::toString(env, text);
+  if (text) {
+    env->DeleteLocalRef(text);
+  }
+  return message;
+}
+
+// JavaPromiseBase
+
+JavaPromiseBase::JavaPromiseBase() {
+  JNIEnv *env = Tools::attachJniEnv();
+  const FutureMethods &methods = futureMethods(env);
+  jobject local = env->NewObject(methods.futureClass, methods.constructor);
+  Tools::checkException(env);
+  future_ = JNIObject::CreateShared(local);
+  future_->makeGlobalRef();
+  env->DeleteLocalRef(local);
+}
+
+void JavaPromiseBase::complete(JNIEnv *env, jobject value) {
+  env->CallBooleanMethod(future_->instance, futureMethods(env).complete, value);
+  Tools::checkException(env);
+}
+
+void JavaPromiseBase::setException(const std::string &message) {
+  JNIEnv *env = Tools::attachJniEnv();
+  const FutureMethods &methods = futureMethods(env);
+  jstring text = Tools::toJString(env, message);
+  jobject error = env->NewObject(methods.runtimeException, methods.runtimeExceptionConstructor, text);
+  env->DeleteLocalRef(text);
+  Tools::checkException(env);
+  env->CallBooleanMethod(future_->instance, methods.completeExceptionally, error);
+  env->DeleteLocalRef(error);
+  Tools::checkException(env);
+}
+
+
+}
@@ -0,0 +1,196 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+#include "safejni_callable.h"
+
+#include <atomic>
+#include <future>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define SAFEJNI_HAS_COROUTINES 1
+#endif
+
+
+namespace safejni {
+
+
+#pragma mark CompletableFuture Bridging
+
+//Attaches a one-shot safejni.NativeCallable to future.whenComplete(). The invoker runs on the
+//thread that completes the java future with (result, null) or (null, throwable).
+void whenComplete(JNIEnv *env, jobject completableFuture, CallableRegistry::Invoker invoker);
+
+//Throwable.toString() of a completion error, CompletionException wrappers are unwrapped
+std::string describeThrowable(JNIEnv *env, jobject throwable);
+
+template<typename T>
+struct FutureValue {
+  inline static void set(JNIEnv *env, std::promise<T> &promise, jobject result) {
+    promise.set_value(CallableArgument<T>::convert(env, result));
+  }
+};
+
+template<>
+struct FutureValue<void> {
+  inline static void set(JNIEnv *, std::promise<void> &promise, jobject) {
+    promise.set_value();
+  }
+};
+
+//java CompletableFuture -> std::future, the result is converted with JNIToCPPConversor<T>
+template<typename T>
+std::future<T> toStdFuture(jobject completableFuture) {
+  auto promise = std::make_shared<std::promise<T>>();
+  std::future<T> future = promise->get_future();
+  whenComplete(Tools::attachJniEnv(), completableFuture,
+               [promise](JNIEnv *env, jobject result, jobject error) -> jobject {
+                 if (error) {
+                   promise->set_exception(std::make_exception_ptr(
+                           JNIException(describeThrowable(env, error))));
+                 } else {
+                   try {
+                     FutureValue<T>::set(env, *promise, result);
+                   } catch (...) {
+                     promise->set_exception(std::current_exception());
+                   }
+                 }
+                 return nullptr;
+               });
+  return future;
+}
+
+template<typename T>
+inline std::future<T> toStdFuture(const JNIObjectPtr &completableFuture) {
+  return toStdFuture<T>(completableFuture->instance);
+}
+
+//A java CompletableFuture completed from native code
+class JavaPromiseBase {
+public:
+  //the java side of the promise (global ref), hand it to java callers
+  const JNIObjectPtr &future() const { return future_; }
+
+  void setException(const std::string &message);
+
+protected:
+  JavaPromiseBase();
+
+  //CompletableFuture.complete(value), value may be null
+  void complete(JNIEnv *env, jobject value);
+
+  JNIObjectPtr future_;
+};
+
+//the value goes through CPPToJNIConversor<T>
+template<typename T>
+class JavaPromise : public JavaPromiseBase {
+public:
+  void setValue(const T &value) {
+    JNIEnv *env = Tools::attachJniEnv();
+    jobject result = CallableResult<T>::convert(env, value);
+    complete(env, result);
+    if (result) {
+      env->DeleteLocalRef(result);
+    }
+  }
+
+  //completes the java future when a native future resolves, blocking the calling thread
+  void setFrom(std::future<T> &native) {
+    try {
+      setValue(native.get());
+    } catch (const std::exception &e) {
+      setException(e.what());
+    }
+  }
+};
+
+template<>
+class JavaPromise<void> : public JavaPromiseBase {
+public:
+  void setValue() { complete(Tools::attachJniEnv(), nullptr); }
+
+  void setFrom(std::future<void> &native) {
+    try {
+      native.get();
+      setValue();
+    } catch (const std::exception &e) {
+      setException(e.what());
+    }
+  }
+};
+
+#ifdef SAFEJNI_HAS_COROUTINES
+
+//co_await awaitJava<T>(future) suspends until the java future completes and resumes the
+//coroutine on the completing java thread; an already completed future does not suspend
+template<typename T>
+class JavaFutureAwaitable {
+public:
+  explicit JavaFutureAwaitable(jobject completableFuture)
+          : future_(JNIObject::CreateShared(completableFuture)),
+            state_(std::make_shared<State>()) {
+    future_->makeGlobalRef();
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    auto state = state_;
+    state->future = state->promise.get_future();
+    whenComplete(Tools::attachJniEnv(), future_->instance,
+                 [state, handle](JNIEnv *env, jobject result, jobject error) -> jobject {
+                   if (error) {
+                     state->promise.set_exception(std::make_exception_ptr(
+                             JNIException(describeThrowable(env, error))));
+                   } else {
+                     try {
+                       FutureValue<T>::set(env, state->promise, result);
+                     } catch (...) {
+                       state->promise.set_exception(std::current_exception());
+                     }
+                   }
+                   //whichever side comes second owns the continuation
+                   if (state->handoff.exchange(true, std::memory_order_acq_rel)) {
+                     handle.resume();
+                   }
+                   return nullptr;
+                 });
+    //false when whenComplete already ran the callback synchronously: carry on without resuming
+    //from inside it
+    return !state->handoff.exchange(true, std::memory_order_acq_rel);
+  }
+
+  T await_resume() { return state_->future.get(); }
+
+private:
+  struct State {
+    std::promise<T> promise;
+    std::future<T> future;
+    std::atomic<bool> handoff{false};
+  };
+
+  JNIObjectPtr future_;
+  std::shared_ptr<State> state_;
+};
+
+template<typename T>
+inline JavaFutureAwaitable<T> awaitJava(jobject completableFuture) {
+  return JavaFutureAwaitable<T>(completableFuture);
+}
+
+template<typename T>
+inline JavaFutureAwaitable<T> awaitJava(const JNIObjectPtr &completableFuture) {
+  return JavaFutureAwaitable<T>(completableFuture->instance);
+}
+
+#endif
+
+
+}
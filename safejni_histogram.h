@@ -0,0 +1,124 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+
+namespace safejni {
+
+
+#pragma mark Latency Histogram
+
+//Lock free log-linear histogram of nanosecond samples: exact below 16, then 8 sub-buckets per
+//power of two (about 12% relative error). record() is a couple of relaxed atomic adds.
+class LatencyHistogram {
+public:
+  static constexpr int kBuckets = 16 + 60 * 8;
+
+  static uint64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static int bucketOf(uint64_t nanos) {
+    if (nanos < 16) {
+      return static_cast<int>(nanos);
+    }
+    int msb = 63 - __builtin_clzll(nanos);
+    return 16 + (msb - 4) * 8 + static_cast<int>((nanos >> (msb - 3)) & 7);
+  }
+
+  //largest sample that falls in the bucket
+  static uint64_t bucketUpperBound(int bucket) {
+    if (bucket < 16) {
+      return static_cast<uint64_t>(bucket);
+    }
+    int msb = (bucket - 16) / 8 + 4;
+    uint64_t sub = static_cast<uint64_t>((bucket - 16) % 8);
+    if (msb == 63 && sub == 7) {
+      return UINT64_MAX;
+    }
+    return ((8 + sub + 1) << (msb - 3)) - 1;
+  }
+
+  void record(uint64_t nanos) {
+    buckets_[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(nanos, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (nanos > max && !max_.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+    }
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+  double mean() const {
+    uint64_t n = count();
+    return n ? static_cast<double>(sum_.load(std::memory_order_relaxed)) / n : 0.0;
+  }
+
+  uint64_t bucketCount(int bucket) const { return buckets_[bucket].load(std::memory_order_relaxed); }
+
+  //upper bound of the bucket holding the p-th percentile (p in [0, 100])
+  uint64_t percentile(double p) const {
+    uint64_t n = count();
+    if (n == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * n + 0.5);
+    if (rank == 0) {
+      rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= rank) {
+        uint64_t bound = bucketUpperBound(i);
+        return bound < max() ? bound : max();
+      }
+    }
+    return max();
+  }
+
+  //adds another histogram's samples, e.g. to combine per-thread histograms after a run
+  void merge(const LatencyHistogram &other) {
+    for (int i = 0; i < kBuckets; ++i) {
+      buckets_[i].fetch_add(other.bucketCount(i), std::memory_order_relaxed);
+    }
+    count_.fetch_add(other.count(), std::memory_order_relaxed);
+    sum_.fetch_add(other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    uint64_t otherMax = other.max();
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (otherMax > max && !max_.compare_exchange_weak(max, otherMax, std::memory_order_relaxed)) {
+    }
+  }
+
+  void reset() {
+    for (auto &bucket : buckets_) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> buckets_[kBuckets] = {};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+
+}
@@ -0,0 +1,152 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_inbound.h"
+
+#include <cerrno>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace safejni {
+
+
+jclass InboundQueueBase::classId_ = nullptr;
+jmethodID InboundQueueBase::constructor_ = nullptr;
+
+namespace {
+
+//message id of the post in progress on this thread, the registry invoker only carries objects
+thread_local jint postingWhat = 0;
+
+void throwJava(JNIEnv *env, const char *className, const char *message) {
+  if (!env->ExceptionCheck()) {
+    jclass error = env->FindClass(className);
+    env->ThrowNew(error, message);
+    env->DeleteLocalRef(error);
+  }
+}
+
+void JNICALL nativePost(JNIEnv *env, jclass, jlong handle, jint what, jobject payload) {
+  try {
+    postingWhat = what;
+    jobject unused = nullptr;
+    if (!CallableRegistry::shared().invoke(handle, env, payload, nullptr, unused)) {
+      throwJava(env, "java/lang/IllegalStateException", "NativeQueue has been destroyed");
+    }
+  } catch (const std::exception &e) {
+    throwJava(env, "java/lang/RuntimeException", e.what());
+  } catch (...) {
+    throwJava(env, "java/lang/RuntimeException", "unknown native exception");
+  }
+}
+
+}
+
+void InboundQueueBase::registerNatives(JNIEnv *env, const char *className) {
+  jclass clazz = env->FindClass(className);
+  Tools::checkException(env);
+  if (!clazz) {
+    throw JNIException(std::string("Could not find the given class: ") + className);
+  }
+  static JNINativeMethod methods[] = {
+          {const_cast<char *>("nativePost"), const_cast<char *>("(JILjava/lang/Object;)V"),
+                  reinterpret_cast<void *>(nativePost)},
+  };
+  if (env->RegisterNatives(clazz, methods, sizeof(methods) / sizeof(methods[0])) < 0) {
+    env->DeleteLocalRef(clazz);
+    Tools::checkException(env);
+    throw JNIException("register failed");
+  }
+  constructor_ = env->GetMethodID(clazz, "<init>", "(J)V");
+  Tools::checkException(env);
+  if (classId_) {
+    env->DeleteGlobalRef(classId_);
+  }
+  classId_ = static_cast<jclass>(env->NewGlobalRef(clazz));
+  env->DeleteLocalRef(clazz);
+}
+
+InboundQueueBase::InboundQueueBase() {
+  eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventFd_ < 0) {
+    throw JNIException(std::string("eventfd failed: ") + strerror(errno));
+  }
+}
+
+InboundQueueBase::~InboundQueueBase() {
+  detach();
+  ::close(eventFd_);
+}
+
+void InboundQueueBase::detach() {
+  jlong handle = handle_;
+  handle_ = 0;
+  if (handle) {
+    CallableRegistry::shared().removeAndWait(handle);
+  }
+}
+
+JNIObjectPtr InboundQueueBase::javaObject() {
+  if (javaObject_) {
+    return javaObject_;
+  }
+  if (!classId_) {
+    throw JNIException("InboundQueueBase::registerNatives has not been called");
+  }
+  JNIEnv *env = Tools::attachJniEnv();
+  //a generation checked handle, so posts racing with or following destruction fail cleanly
+  jlong handle = CallableRegistry::shared().add([this](JNIEnv *postEnv, jobject payload, jobject) -> jobject {
+    postFromJava(postEnv, postingWhat, payload);
+    return nullptr;
+  });
+  jobject local = env->NewObject(classId_, constructor_, handle);
+  if (!local) {
+    CallableRegistry::shared().remove(handle);
+    Tools::checkException(env);
+    throw JNIException("Could not create NativeQueue");
+  }
+  handle_ = handle;
+  javaObject_ = JNIObject::CreateShared(local);
+  javaObject_->makeGlobalRef();
+  env->DeleteLocalRef(local);
+  return javaObject_;
+}
+
+void InboundQueueBase::signal() {
+  if (signaled_.exchange(true, std::memory_order_acq_rel)) {
+    return;
+  }
+  uint64_t one = 1;
+  ssize_t written;
+  do {
+    written = ::write(eventFd_, &one, sizeof(one));
+  } while (written < 0 && errno == EINTR);
+  stats_.wakeups.fetch_add(1, std::memory_order_relaxed);
+}
+
+void InboundQueueBase::acknowledge() {
+  uint64_t value;
+  ssize_t done;
+  do {
+    done = ::read(eventFd_, &value, sizeof(value));
+  } while (done < 0 && errno == EINTR);
+  //reset after the read, a post racing with the drain then signals again (at worst spuriously)
+  signaled_.store(false, std::memory_order_release);
+}
+
+void InboundQueueBase::recordDequeue(uint64_t enqueuedNanos) {
+  uint64_t latency = nowNanos() - enqueuedNanos;
+  stats_.dequeued.fetch_add(1, std::memory_order_relaxed);
+  stats_.totalLatencyNanos.fetch_add(latency, std::memory_order_relaxed);
+  uint64_t max = stats_.maxLatencyNanos.load(std::memory_order_relaxed);
+  while (latency > max &&
+         !stats_.maxLatencyNanos.compare_exchange_weak(max, latency, std::memory_order_relaxed)) {
+  }
+}
+
+
+}
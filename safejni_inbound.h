@@ -0,0 +1,148 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+#include "safejni_callable.h"
+#include "safejni_mpsc.h"
+
+#include <atomic>
+#include <chrono>
+
+
+namespace safejni {
+
+
+#pragma mark Inbound Queue
+
+struct InboundQueueStats {
+  std::atomic<uint64_t> enqueued{0};
+  std::atomic<uint64_t> dequeued{0};
+  std::atomic<uint64_t> wakeups{0};
+  //enqueue to dequeue latency
+  std::atomic<uint64_t> totalLatencyNanos{0};
+  std::atomic<uint64_t> maxLatencyNanos{0};
+
+  double meanLatencyNanos() const {
+    uint64_t count = dequeued.load(std::memory_order_relaxed);
+    return count ? static_cast<double>(totalLatencyNanos.load(std::memory_order_relaxed)) / count : 0.0;
+  }
+};
+
+//Untyped part of an inbound queue: the eventfd, the java facing safejni.NativeQueue object and
+//the registered nativePost entry point.
+class InboundQueueBase {
+public:
+  //registers NativeQueue.nativePost, run it once where the class is visible (e.g. JNI_OnLoad)
+  static void registerNatives(JNIEnv *env, const char *className = "safejni/NativeQueue");
+
+  virtual ~InboundQueueBase();
+
+  InboundQueueBase(const InboundQueueBase &) = delete;
+
+  InboundQueueBase &operator=(const InboundQueueBase &) = delete;
+
+  //readable when messages are waiting, add it to an epoll set with EPOLLIN
+  int fd() const { return eventFd_; }
+
+  //a safejni.NativeQueue bound to this queue (global ref), posting to it once the queue is
+  //destroyed throws IllegalStateException
+  JNIObjectPtr javaObject();
+
+  const InboundQueueStats &stats() const { return stats_; }
+
+  static uint64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  //called by nativePost on the posting java thread
+  virtual void postFromJava(JNIEnv *env, jint what, jobject payload) = 0;
+
+protected:
+  InboundQueueBase();
+
+  //wakes the consumer unless a wakeup is already pending
+  void signal();
+
+  //clears the eventfd before a drain so later posts signal again
+  void acknowledge();
+
+  void recordDequeue(uint64_t enqueuedNanos);
+
+  //invalidates the java handle and waits for posts in progress, run it before members go away
+  void detach();
+
+  InboundQueueStats stats_;
+
+private:
+  int eventFd_;
+  std::atomic<bool> signaled_{false};
+  JNIObjectPtr javaObject_;
+  jlong handle_ = 0;
+
+  static jclass classId_;
+  static jmethodID constructor_;
+};
+
+template<typename T>
+struct InboundMessage {
+  int what = 0;
+  T payload;
+  uint64_t enqueuedNanos = 0;
+};
+
+//Java -> native message queue with payloads converted through the existing conversors.
+//Any thread may post, one consumer thread drains (typically from its epoll loop on fd()).
+template<typename T>
+class InboundQueue : public InboundQueueBase {
+public:
+  typedef InboundMessage<T> Message;
+
+  InboundQueue() = default;
+
+  ~InboundQueue() override {
+    detach();
+  }
+
+  void post(int what, T payload) {
+    Message message;
+    message.what = what;
+    message.payload = std::move(payload);
+    message.enqueuedNanos = nowNanos();
+    queue_.push(std::move(message));
+    stats_.enqueued.fetch_add(1, std::memory_order_relaxed);
+    signal();
+  }
+
+  void postFromJava(JNIEnv *env, jint what, jobject payload) override {
+    post(what, CallableArgument<T>::convert(env, payload));
+  }
+
+  //hands up to `max` waiting messages to fn(Message &), returns how many were handled
+  template<typename F>
+  size_t drain(F fn, size_t max = SIZE_MAX) {
+    acknowledge();
+    size_t handled = 0;
+    Message message;
+    while (handled < max && queue_.pop(message)) {
+      recordDequeue(message.enqueuedNanos);
+      fn(message);
+      handled++;
+    }
+    if (handled == max && !queue_.empty()) {
+      signal();
+    }
+    return handled;
+  }
+
+private:
+  MpscQueue<Message> queue_;
+};
+
+
+}
@@ -0,0 +1,192 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_mmap.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace safejni {
+
+
+jclass MappedFile::classId_ = nullptr;
+jmethodID MappedFile::constructor_ = nullptr;
+jmethodID MappedFile::buffer_ = nullptr;
+
+namespace {
+
+void JNICALL nativeRelease(JNIEnv *, jclass, jlong handle) {
+  MappedFile::Release(handle);
+}
+
+}
+
+void MappedFile::registerNatives(JNIEnv *env, const char *className) {
+  jclass clazz = env->FindClass(className);
+  Tools::checkException(env);
+  if (!clazz) {
+    throw JNIException(string("Could not find the given class: ") + className);
+  }
+  static JNINativeMethod methods[] = {
+          {const_cast<char *>("nativeRelease"), const_cast<char *>("(J)V"),
+                  reinterpret_cast<void *>(nativeRelease)},
+  };
+  if (env->RegisterNatives(clazz, methods, sizeof(methods) / sizeof(methods[0])) < 0) {
+    env->DeleteLocalRef(clazz);
+    Tools::checkException(env);
+    throw JNIException("register failed");
+  }
+  constructor_ = env->GetMethodID(clazz, "<init>", "(Ljava/nio/ByteBuffer;J)V");
+  Tools::checkException(env);
+  buffer_ = env->GetMethodID(clazz, "buffer", "()Ljava/nio/ByteBuffer;");
+  Tools::checkException(env);
+  if (classId_) {
+    env->DeleteGlobalRef(classId_);
+  }
+  classId_ = static_cast<jclass>(env->NewGlobalRef(clazz));
+  env->DeleteLocalRef(clazz);
+}
+
+MappedFilePtr MappedFile::Open(const string &path, bool writable) {
+  int fd = ::open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+  if (fd < 0) {
+    throw JNIException(string("Could not open file for mapping: ") + path + ": " + strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int err = errno;
+    ::close(fd);
+    throw JNIException(string("Could not stat file: ") + path + ": " + strerror(err));
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  void *address = nullptr;
+  if (size > 0) {
+    address = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+      int err = errno;
+      ::close(fd);
+      throw JNIException(string("Could not map file: ") + path + ": " + strerror(err));
+    }
+  }
+  //the mapping stays valid after the descriptor is closed
+  ::close(fd);
+  return MappedFilePtr(new MappedFile(address, size, writable));
+}
+
+MappedFile::MappedFile(void *address, size_t size, bool writable) : address_(address),
+                                                                     size_(size),
+                                                                     writable_(writable) {
+
+}
+
+MappedFile::~MappedFile() {
+  if (address_) {
+    munmap(address_, size_);
+  }
+}
+
+void MappedFile::checkRange(size_t offset, size_t &length) const {
+  if (offset > size_) {
+    throw JNIException("MappedFile: offset past the end of the mapping");
+  }
+  if (length == 0) {
+    length = size_ - offset;
+  }
+  if (length > size_ - offset) {
+    throw JNIException("MappedFile: range past the end of the mapping");
+  }
+}
+
+void MappedFile::advise(Advice advice, size_t offset, size_t length) {
+  checkRange(offset, length);
+  if (!address_ || length == 0) {
+    return;
+  }
+  int flag = MADV_NORMAL;
+  switch (advice) {
+    case Advice::Normal:
+      flag = MADV_NORMAL;
+      break;
+    case Advice::Sequential:
+      flag = MADV_SEQUENTIAL;
+      break;
+    case Advice::Random:
+      flag = MADV_RANDOM;
+      break;
+    case Advice::WillNeed:
+      flag = MADV_WILLNEED;
+      break;
+    case Advice::DontNeed:
+      flag = MADV_DONTNEED;
+      break;
+  }
+  //madvise wants a page aligned start
+  static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t aligned = offset & ~(pageSize - 1);
+  if (madvise(static_cast<uint8_t *>(address_) + aligned, length + (offset - aligned), flag) != 0) {
+    throw JNIException(string("madvise failed: ") + strerror(errno));
+  }
+}
+
+JNIObjectPtr MappedFile::toRegion(size_t offset, size_t length) {
+  checkRange(offset, length);
+  if (!classId_) {
+    throw JNIException("MappedFile::registerNatives has not been called");
+  }
+  JNIEnv *env = Tools::attachJniEnv();
+  jobject buffer = env->NewDirectByteBuffer(static_cast<uint8_t *>(address_) + offset,
+                                            static_cast<jlong>(length));
+  Tools::checkException(env);
+  if (!buffer) {
+    throw JNIException("NewDirectByteBuffer is not supported by this VM");
+  }
+  //the region owns this handle from here on
+  jlong handle = Retain(shared_from_this());
+  jobject region = env->NewObject(classId_, constructor_, buffer, handle);
+  env->DeleteLocalRef(buffer);
+  if (!region) {
+    Release(handle);
+    Tools::checkException(env);
+    throw JNIException("Could not create MappedRegion");
+  }
+  JNIObjectPtr result = JNIObject::CreateGlobal(region);
+  env->DeleteLocalRef(region);
+  return result;
+}
+
+JNIObjectPtr MappedFile::toByteBuffer(size_t offset, size_t length) {
+  JNIObjectPtr region = toRegion(offset, length);
+  JNIEnv *env = Tools::attachJniEnv();
+  jobject buffer = env->CallObjectMethod(region->instance, buffer_);
+  Tools::checkException(env);
+  JNIObjectPtr result = JNIObject::CreateGlobal(buffer);
+  env->DeleteLocalRef(buffer);
+  return result;
+}
+
+jlong MappedFile::Retain(const MappedFilePtr &file) {
+  return reinterpret_cast<jlong>(new MappedFilePtr(file));
+}
+
+MappedFilePtr MappedFile::FromHandle(jlong handle) {
+  if (!handle) {
+    return MappedFilePtr();
+  }
+  return *reinterpret_cast<MappedFilePtr *>(handle);
+}
+
+void MappedFile::Release(jlong handle) {
+  delete reinterpret_cast<MappedFilePtr *>(handle);
+}
+
+
+}
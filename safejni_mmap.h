@@ -0,0 +1,83 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+
+#include <cstddef>
+
+
+namespace safejni {
+
+
+#pragma mark Memory Mapped Files
+
+//A read-only (or shared writable) mapping of a file that java sees as direct ByteBuffers.
+//Buffers point straight into the mapping, so each one holds a Retain()ed handle that the
+//bundled safejni.MappedRegion releases from a reference queue or an explicit close().
+class MappedFile : public std::enable_shared_from_this<MappedFile> {
+public:
+  //registers MappedRegion.nativeRelease, run it once where the class is visible (e.g. JNI_OnLoad)
+  static void registerNatives(JNIEnv *env, const char *className = "safejni/MappedRegion");
+
+  enum class Advice {
+    Normal,
+    Sequential,
+    Random,
+    WillNeed,
+    DontNeed
+  };
+
+  static std::shared_ptr<MappedFile> Open(const std::string &path, bool writable = false);
+
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const { return static_cast<const uint8_t *>(address_); }
+
+  uint8_t *mutableData() { return writable_ ? static_cast<uint8_t *>(address_) : nullptr; }
+
+  size_t size() const { return size_; }
+
+  //madvise hint for [offset, offset + length), a zero length means up to the end of the file
+  void advise(Advice advice, size_t offset = 0, size_t length = 0);
+
+  //wraps [offset, offset + length) as a safejni.MappedRegion (global ref), zero length means
+  //the rest; close() it to unmap as soon as java is done
+  JNIObjectPtr toRegion(size_t offset = 0, size_t length = 0);
+
+  //the region's direct ByteBuffer alone (global ref), the mapping lives until it is collected
+  JNIObjectPtr toByteBuffer(size_t offset = 0, size_t length = 0);
+
+  //native handle for java, owning one reference to the mapping
+  static jlong Retain(const std::shared_ptr<MappedFile> &file);
+
+  static std::shared_ptr<MappedFile> FromHandle(jlong handle);
+
+  static void Release(jlong handle);
+
+private:
+  MappedFile(void *address, size_t size, bool writable);
+
+  void checkRange(size_t offset, size_t &length) const;
+
+  void *address_;
+  size_t size_;
+  bool writable_;
+
+  static jclass classId_;
+  static jmethodID constructor_;
+  static jmethodID buffer_;
+};
+
+typedef std::shared_ptr<MappedFile> MappedFilePtr;
+
+
+}
@@ -0,0 +1,88 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+namespace safejni {
+
+
+#pragma mark Lock Free MPSC Queue
+
+//Unbounded multi-producer single-consumer queue (Vyukov). push() is wait free, pop() must only
+//be called from one consumer thread at a time.
+template<typename T>
+class MpscQueue {
+public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {
+    stub_.next.store(nullptr, std::memory_order_relaxed);
+  }
+
+  ~MpscQueue() {
+    Node *node = tail_->next.load(std::memory_order_acquire);
+    while (node) {
+      Node *next = node->next.load(std::memory_order_acquire);
+      reinterpret_cast<T *>(&node->storage)->~T();
+      delete node;
+      node = next;
+    }
+    if (tail_ != &stub_) {
+      delete tail_;
+    }
+  }
+
+  MpscQueue(const MpscQueue &) = delete;
+
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  void push(T value) {
+    Node *node = new Node;
+    new(&node->storage) T(std::move(value));
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node *previous = head_.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  //false when empty, or when a producer is between its exchange and its link
+  bool pop(T &value) {
+    Node *tail = tail_;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (!next) {
+      return false;
+    }
+    T *item = reinterpret_cast<T *>(&next->storage);
+    value = std::move(*item);
+    item->~T();
+    tail_ = next;
+    if (tail != &stub_) {
+      delete tail;
+    }
+    return true;
+  }
+
+  bool empty() const {
+    return !tail_->next.load(std::memory_order_acquire);
+  }
+
+private:
+  struct Node {
+    std::atomic<Node *> next;
+    //constructed on push, destroyed once popped (the node then acts as the new stub)
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  std::atomic<Node *> head_;
+  Node *tail_;
+  Node stub_;
+};
+
+
+}
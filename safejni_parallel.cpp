@@ -0,0 +1,167 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_parallel.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace safejni {
+
+
+namespace {
+
+//slices are kept cache line aligned so neighbouring workers never share a line
+const size_t kSliceAlignment = 64;
+
+}
+
+ParallelArrayCopier::ParallelArrayCopier(size_t workers, size_t parallelThreshold)
+        : parallelThreshold_(parallelThreshold) {
+  if (workers == 0) {
+    unsigned int cores = std::thread::hardware_concurrency();
+    workers = cores > 1 ? cores - 1 : 1;
+  }
+  for (size_t i = 0; i < workers; ++i) {
+    threads_.emplace_back(&ParallelArrayCopier::workerLoop, this);
+  }
+}
+
+ParallelArrayCopier::~ParallelArrayCopier() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void ParallelArrayCopier::workerLoop() {
+  JNIEnv *env = Tools::attachJniEnv();
+  for (;;) {
+    std::function<void(JNIEnv *)> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        break;
+      }
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    task(env);
+  }
+  Tools::detachJniEnv();
+}
+
+void ParallelArrayCopier::run(JNIEnv *env, jsize count, size_t elementSize, const SliceJob &job) {
+  size_t slices = threads_.size() + 1;
+  size_t perSlice = (static_cast<size_t>(count) + slices - 1) / slices;
+  size_t alignElements = std::max<size_t>(kSliceAlignment / elementSize, 1);
+  perSlice = (perSlice + alignElements - 1) / alignElements * alignElements;
+
+  std::mutex doneMutex;
+  std::condition_variable doneCondition;
+  size_t pending = 0;
+  std::atomic<bool> failed(false);
+
+  jsize callerStart = 0;
+  jsize callerCount = static_cast<jsize>(std::min<size_t>(perSlice, count));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t start = perSlice; start < static_cast<size_t>(count); start += perSlice) {
+      jsize sliceStart = static_cast<jsize>(start);
+      jsize sliceCount = static_cast<jsize>(std::min<size_t>(perSlice, count - start));
+      pending++;
+      queue_.emplace_back([&, sliceStart, sliceCount](JNIEnv *workerEnv) {
+        if (!job(workerEnv, sliceStart, sliceCount)) {
+          workerEnv->ExceptionClear();
+          failed = true;
+        }
+        std::lock_guard<std::mutex> doneLock(doneMutex);
+        if (--pending == 0) {
+          doneCondition.notify_one();
+        }
+      });
+    }
+  }
+  wake_.notify_all();
+
+  bool callerOk = job(env, callerStart, callerCount);
+
+  std::unique_lock<std::mutex> doneLock(doneMutex);
+  doneCondition.wait(doneLock, [&] { return pending == 0; });
+  doneLock.unlock();
+
+  if (!callerOk) {
+    Tools::checkException(env);
+  }
+  if (failed) {
+    throw JNIException("ParallelArrayCopier: a worker slice failed");
+  }
+}
+
+std::vector<uint8_t> ParallelArrayCopier::toVectorByte(JNIEnv *env, jbyteArray array) {
+  if (!array) {
+    return std::vector<uint8_t>();
+  }
+  jsize size = env->GetArrayLength(array);
+  std::vector<uint8_t> result(size);
+  copyToNative(env, array, 0, size, reinterpret_cast<jbyte *>(result.data()));
+  return result;
+}
+
+jbyteArray ParallelArrayCopier::toJByteArray(JNIEnv *env, const std::vector<uint8_t> &data) {
+  jbyteArray array = env->NewByteArray(static_cast<jsize>(data.size()));
+  Tools::checkException(env);
+  copyToJava(env, reinterpret_cast<const jbyte *>(data.data()), array, 0,
+             static_cast<jsize>(data.size()));
+  return array;
+}
+
+std::vector<ParallelArrayCopier::CalibrationPoint>
+ParallelArrayCopier::calibrate(JNIEnv *env, const std::vector<size_t> &sizes, int rounds) {
+  typedef std::chrono::steady_clock Clock;
+  std::vector<CalibrationPoint> points;
+  size_t savedThreshold = parallelThreshold_;
+  size_t crossover = 0;
+
+  for (size_t bytes : sizes) {
+    jbyteArray array = env->NewByteArray(static_cast<jsize>(bytes));
+    Tools::checkException(env);
+    std::vector<jbyte> buffer(bytes);
+    CalibrationPoint point = {bytes, 0, 0};
+
+    for (int pass = 0; pass < 2; ++pass) {
+      //pass 0 forces a single region copy, pass 1 forces the parallel path
+      parallelThreshold_ = pass == 0 ? SIZE_MAX : 0;
+      double best = 0;
+      for (int round = 0; round < rounds; ++round) {
+        Clock::time_point start = Clock::now();
+        copyToJava(env, buffer.data(), array, 0, static_cast<jsize>(bytes));
+        copyToNative(env, array, 0, static_cast<jsize>(bytes), buffer.data());
+        double nanos = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (round == 0 || nanos < best) {
+          best = nanos;
+        }
+      }
+      (pass == 0 ? point.singleNanos : point.parallelNanos) = best;
+    }
+    env->DeleteLocalRef(array);
+    points.push_back(point);
+    if (!crossover && point.parallelNanos < point.singleNanos) {
+      crossover = bytes;
+    }
+  }
+  parallelThreshold_ = crossover ? crossover : savedThreshold;
+  return points;
+}
+
+
+}
@@ -0,0 +1,132 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+
+namespace safejni {
+
+
+#pragma mark Parallel Array Copy
+
+//Splits very large region copies across worker threads that stay attached to the VM.
+//The array is promoted to a temporary global ref so every worker can address it, and
+//each worker copies a disjoint slice. Below parallelThreshold a single region copy is used.
+class ParallelArrayCopier {
+public:
+  struct CalibrationPoint {
+    size_t bytes;
+    double singleNanos;
+    double parallelNanos;
+  };
+
+  //workers = 0 picks hardware_concurrency() - 1, the calling thread always takes a slice too
+  explicit ParallelArrayCopier(size_t workers = 0, size_t parallelThreshold = 8 * 1024 * 1024);
+
+  ~ParallelArrayCopier();
+
+  ParallelArrayCopier(const ParallelArrayCopier &) = delete;
+
+  ParallelArrayCopier &operator=(const ParallelArrayCopier &) = delete;
+
+  //java -> native
+  template<typename A>
+  void copyToNative(JNIEnv *env, A array, jsize offset, jsize count,
+                    typename JNIArrayTraits<A>::ElementType *dst);
+
+  //native -> java
+  template<typename A>
+  void copyToJava(JNIEnv *env, const typename JNIArrayTraits<A>::ElementType *src, A array,
+                  jsize offset, jsize count);
+
+  std::vector<uint8_t> toVectorByte(JNIEnv *env, jbyteArray array);
+
+  jbyteArray toJByteArray(JNIEnv *env, const std::vector<uint8_t> &data);
+
+  //times single vs parallel byte[] copies for each size (both directions summed), sets
+  //parallelThreshold to the smallest size where the parallel copy won and returns the samples
+  std::vector<CalibrationPoint> calibrate(JNIEnv *env, const std::vector<size_t> &sizes,
+                                          int rounds = 3);
+
+  size_t parallelThreshold() const { return parallelThreshold_; }
+
+  void setParallelThreshold(size_t bytes) { parallelThreshold_ = bytes; }
+
+  size_t workers() const { return threads_.size(); }
+
+private:
+  typedef std::function<bool(JNIEnv *env, jsize start, jsize count)> SliceJob;
+
+  //runs job over [0, count) split in workers() + 1 slices, throws if any slice failed
+  void run(JNIEnv *env, jsize count, size_t elementSize, const SliceJob &job);
+
+  void workerLoop();
+
+  size_t parallelThreshold_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<std::function<void(JNIEnv *)>> queue_;
+  bool stopping_ = false;
+};
+
+template<typename A>
+void ParallelArrayCopier::copyToNative(JNIEnv *env, A array, jsize offset, jsize count,
+                                       typename JNIArrayTraits<A>::ElementType *dst) {
+  checkArrayBounds(env, array, offset, count);
+  using E = typename JNIArrayTraits<A>::ElementType;
+  if (static_cast<size_t>(count) * sizeof(E) < parallelThreshold_ || threads_.empty()) {
+    JNIArrayTraits<A>::getRegion(env, array, offset, count, dst);
+    Tools::checkException(env);
+    return;
+  }
+  A global = static_cast<A>(env->NewGlobalRef(array));
+  try {
+    run(env, count, sizeof(E), [global, offset, dst](JNIEnv *workerEnv, jsize start, jsize length) {
+      JNIArrayTraits<A>::getRegion(workerEnv, global, offset + start, length, dst + start);
+      return !workerEnv->ExceptionCheck();
+    });
+  } catch (...) {
+    env->DeleteGlobalRef(global);
+    throw;
+  }
+  env->DeleteGlobalRef(global);
+}
+
+template<typename A>
+void ParallelArrayCopier::copyToJava(JNIEnv *env, const typename JNIArrayTraits<A>::ElementType *src,
+                                     A array, jsize offset, jsize count) {
+  checkArrayBounds(env, array, offset, count);
+  using E = typename JNIArrayTraits<A>::ElementType;
+  if (static_cast<size_t>(count) * sizeof(E) < parallelThreshold_ || threads_.empty()) {
+    JNIArrayTraits<A>::setRegion(env, array, offset, count, src);
+    Tools::checkException(env);
+    return;
+  }
+  A global = static_cast<A>(env->NewGlobalRef(array));
+  try {
+    run(env, count, sizeof(E), [global, offset, src](JNIEnv *workerEnv, jsize start, jsize length) {
+      JNIArrayTraits<A>::setRegion(workerEnv, global, offset + start, length, src + start);
+      return !workerEnv->ExceptionCheck();
+    });
+  } catch (...) {
+    env->DeleteGlobalRef(global);
+    throw;
+  }
+  env->DeleteGlobalRef(global);
+}
+
+
+}
@@ -0,0 +1,122 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+//USDT tracepoints (provider "safejni") on JNI transitions and conversions, e.g.
+//  bpftrace -e 'usdt:./libapp.so:safejni:call__entry { @[str(arg1)] = count(); }'
+//A probe is a single nop until a tracer attaches. Without <sys/sdt.h>, or with
+//SAFEJNI_NO_USDT defined, every probe compiles to nothing.
+//
+//  call__entry(class, method, signature, nargs)        call__return(method)
+//  static__entry(class, method, signature, nargs)      static__return(method)
+//  newobject__entry(class, signature, nargs)           newobject__return(class)
+//  resolve__entry(class, method, signature, static)    resolve__return(method, methodId)
+//  convert__entry(kind, size)                          convert__return(kind, size)
+//size is in elements (characters for strings, entries for maps) of the input, or of the
+//result for JNI -> C++ conversions, and -1 when it would cost extra work to compute.
+
+#if defined(__linux__) && !defined(SAFEJNI_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SAFEJNI_HAS_USDT 1
+#endif
+#endif
+
+#ifdef SAFEJNI_HAS_USDT
+#define SAFEJNI_PROBE1(name, a) DTRACE_PROBE1(safejni, name, a)
+#define SAFEJNI_PROBE2(name, a, b) DTRACE_PROBE2(safejni, name, a, b)
+#define SAFEJNI_PROBE3(name, a, b, c) DTRACE_PROBE3(safejni, name, a, b, c)
+#define SAFEJNI_PROBE4(name, a, b, c, d) DTRACE_PROBE4(safejni, name, a, b, c, d)
+#else
+//the arguments are still "used", so disabled probes leave no unused parameter warnings
+#define SAFEJNI_PROBE1(name, a) do { (void) (a); } while (0)
+#define SAFEJNI_PROBE2(name, a, b) do { (void) (a); (void) (b); } while (0)
+#define SAFEJNI_PROBE3(name, a, b, c) do { (void) (a); (void) (b); (void) (c); } while (0)
+#define SAFEJNI_PROBE4(name, a, b, c, d) do { (void) (a); (void) (b); (void) (c); (void) (d); } while (0)
+#endif
+
+
+namespace safejni {
+namespace probes {
+
+
+//entry/return pairs that also fire the return probe when the call throws
+
+struct CallScope {
+  CallScope(const char *className, const char *method, const char *signature, int nargs)
+          : method_(method) {
+    SAFEJNI_PROBE4(call__entry, className, method, signature, nargs);
+  }
+
+  ~CallScope() {
+    SAFEJNI_PROBE1(call__return, method_);
+  }
+
+  const char *method_;
+};
+
+struct StaticCallScope {
+  StaticCallScope(const char *className, const char *method, const char *signature, int nargs)
+          : method_(method) {
+    SAFEJNI_PROBE4(static__entry, className, method, signature, nargs);
+  }
+
+  ~StaticCallScope() {
+    SAFEJNI_PROBE1(static__return, method_);
+  }
+
+  const char *method_;
+};
+
+struct NewObjectScope {
+  NewObjectScope(const char *className, const char *signature, int nargs) : className_(className) {
+    SAFEJNI_PROBE3(newobject__entry, className, signature, nargs);
+  }
+
+  ~NewObjectScope() {
+    SAFEJNI_PROBE1(newobject__return, className_);
+  }
+
+  const char *className_;
+};
+
+struct ResolveScope {
+  ResolveScope(const char *className, const char *method, const char *signature, int isStatic)
+          : method_(method) {
+    SAFEJNI_PROBE4(resolve__entry, className, method, signature, isStatic);
+  }
+
+  ~ResolveScope() {
+    SAFEJNI_PROBE2(resolve__return, method_, methodId_);
+  }
+
+  //stays null when resolution throws
+  void setResult(const void *methodId) { methodId_ = methodId; }
+
+  const char *method_;
+  const void *methodId_ = nullptr;
+};
+
+struct ConvertScope {
+  ConvertScope(const char *kind, long size) : kind_(kind), size_(size) {
+    SAFEJNI_PROBE2(convert__entry, kind, size);
+  }
+
+  ~ConvertScope() {
+    SAFEJNI_PROBE2(convert__return, kind_, size_);
+  }
+
+  //JNI -> C++ conversions only know their size once done
+  void setSize(long size) { size_ = size; }
+
+  const char *kind_;
+  long size_;
+};
+
+
+}
+}
@@ -0,0 +1,117 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_resolution.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <tuple>
+
+using std::string;
+
+namespace safejni {
+
+
+std::atomic<bool> ResolutionTracker::enabled_(false);
+
+namespace {
+
+typedef std::tuple<string, string, string, string> SiteKey;
+
+std::mutex sitesMutex;
+
+std::map<SiteKey, ResolutionSite> &siteMap() {
+  static std::map<SiteKey, ResolutionSite> sites;
+  return sites;
+}
+
+//a member resolved against this many class names is probably fed from SetClassName
+const size_t kVaryingClassNames = 4;
+
+//how to pay for a repeatedly resolved site once
+const char *hoistAdvice(const string &kind) {
+  if (kind == "class") {
+    return "keep a global ref to the jclass instead of resolving the class name per call";
+  }
+  if (kind == "field" || kind == "staticfield") {
+    return "look the jfieldID up once and keep it";
+  }
+  return "resolve it once (Tools::getMethodInfo / getStaticMethodInfo) and keep the SPJNIMethodInfo";
+}
+
+}
+
+void ResolutionTracker::recordSite(const char *kind, const char *className, const char *member,
+                                   const char *signature) {
+  SiteKey key(kind ? kind : "", className ? className : "", member ? member : "",
+              signature ? signature : "");
+  std::lock_guard<std::mutex> lock(sitesMutex);
+  ResolutionSite &site = siteMap()[key];
+  if (site.resolutions++ == 0) {
+    site.kind = std::get<0>(key);
+    site.className = std::get<1>(key);
+    site.member = std::get<2>(key);
+    site.signature = std::get<3>(key);
+  }
+}
+
+std::vector<ResolutionSite> ResolutionTracker::sites(uint64_t minResolutions) {
+  std::vector<ResolutionSite> result;
+  {
+    std::lock_guard<std::mutex> lock(sitesMutex);
+    for (const auto &entry : siteMap()) {
+      if (entry.second.resolutions >= minResolutions) {
+        result.push_back(entry.second);
+      }
+    }
+  }
+  std::sort(result.begin(), result.end(), [](const ResolutionSite &a, const ResolutionSite &b) {
+    return a.resolutions > b.resolutions;
+  });
+  return result;
+}
+
+string ResolutionTracker::report(uint64_t minResolutions) {
+  std::vector<ResolutionSite> all = sites();
+  std::map<std::pair<string, string>, std::set<string>> classesPerMember;
+  for (const ResolutionSite &site : all) {
+    classesPerMember[std::make_pair(site.kind + " " + site.member, site.signature)].insert(
+            site.className);
+  }
+
+  string text;
+  for (const ResolutionSite &site : all) {
+    if (site.resolutions < minResolutions) {
+      continue;
+    }
+    text += std::to_string(site.resolutions) + " x " + site.kind + " " + site.className +
+            (site.className.empty() || site.member.empty() ? "" : ".") + site.member +
+            site.signature + "\n";
+    if (site.resolutions > 1) {
+      text += string("    same descriptor resolved ") + std::to_string(site.resolutions) + " times: " +
+              hoistAdvice(site.kind) + "\n";
+    }
+  }
+  for (const auto &entry : classesPerMember) {
+    if (entry.second.size() >= kVaryingClassNames) {
+      text += entry.first.first + entry.first.second + " resolved against " +
+              std::to_string(entry.second.size()) +
+              " class names: runtime class name (SetClassName?) defeats caching\n";
+    }
+  }
+  return text;
+}
+
+void ResolutionTracker::reset() {
+  std::lock_guard<std::mutex> lock(sitesMutex);
+  siteMap().clear();
+}
+
+
+}
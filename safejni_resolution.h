@@ -0,0 +1,61 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace safejni {
+
+
+#pragma mark Resolution Tracker
+
+struct ResolutionSite {
+  //"method", "static", "nonvirtual", "new", "field", "staticfield" or "class"
+  std::string kind;
+  std::string className;
+  std::string member;
+  std::string signature;
+  uint64_t resolutions = 0;
+};
+
+//Opt-in per-site resolution counts for the lookup layer (getMethodInfo, Get/Set, FindClass of
+//SetClassName). A site is the resolved descriptor, and the wrappers resolve it again on every
+//call; report() lists the sites resolved at least N times with how to resolve them once
+//instead, plus members looked up against many runtime class names.
+class ResolutionTracker {
+public:
+  static void setEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  static void record(const char *kind, const char *className, const char *member,
+                     const char *signature) {
+    if (enabled()) {
+      recordSite(kind, className, member, signature);
+    }
+  }
+
+  //sites resolved at least minResolutions times, most resolved first
+  static std::vector<ResolutionSite> sites(uint64_t minResolutions = 1);
+
+  static std::string report(uint64_t minResolutions);
+
+  static void reset();
+
+private:
+  static void recordSite(const char *kind, const char *className, const char *member,
+                         const char *signature);
+
+  static std::atomic<bool> enabled_;
+};
+
+
+}
@@ -0,0 +1,123 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_scheduler.h"
+
+namespace safejni {
+
+
+JvmCallScheduler::JvmCallScheduler() : JvmCallScheduler(Config()) {
+
+}
+
+JvmCallScheduler::JvmCallScheduler(const Config &config) : config_(config) {
+  size_t reserved = 0;
+  for (int i = 0; i < kPriorityCount; ++i) {
+    reserved += config_.reserved[i];
+  }
+  if (config_.workers == 0 || reserved > config_.workers) {
+    throw JNIException("JvmCallScheduler: invalid worker reservation");
+  }
+  for (int i = 0; i < kPriorityCount; ++i) {
+    for (size_t n = 0; n < config_.reserved[i]; ++n) {
+      threads_.emplace_back(&JvmCallScheduler::workerLoop, this, i);
+    }
+  }
+  for (size_t n = reserved; n < config_.workers; ++n) {
+    threads_.emplace_back(&JvmCallScheduler::workerLoop, this, kPriorityCount - 1);
+  }
+}
+
+JvmCallScheduler::~JvmCallScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void JvmCallScheduler::enqueue(Priority priority, std::chrono::microseconds budget,
+                               std::function<void(JNIEnv *)> fn) {
+  uint64_t now = LatencyHistogram::nowNanos();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      throw JNIException("JvmCallScheduler: submit after shutdown");
+    }
+    Task task;
+    task.deadline = now + std::chrono::duration_cast<std::chrono::nanoseconds>(budget).count();
+    task.enqueued = now;
+    task.sequence = sequence_++;
+    task.fn = std::move(fn);
+    queues_[static_cast<int>(priority)].push(std::move(task));
+  }
+  //reserved workers may not take this class, wake everyone rather than a wrong single worker
+  wake_.notify_all();
+}
+
+int JvmCallScheduler::pickClass(int maxClass, uint64_t now) const {
+  uint64_t starvation = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          config_.starvationLimit).count();
+  //starving less urgent work first, least urgent wins since it has been waiting on everyone else
+  for (int i = maxClass; i > 0; --i) {
+    if (!queues_[i].empty() && now > queues_[i].top().deadline + starvation) {
+      return i;
+    }
+  }
+  for (int i = 0; i <= maxClass; ++i) {
+    if (!queues_[i].empty()) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void JvmCallScheduler::workerLoop(int maxClass) {
+  JNIEnv *env = Tools::attachJniEnv();
+  for (;;) {
+    Task task;
+    int cls;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [&] {
+        cls = pickClass(maxClass, LatencyHistogram::nowNanos());
+        return stopping_ || cls >= 0;
+      });
+      if (cls < 0) {
+        break;
+      }
+      task = std::move(const_cast<Task &>(queues_[cls].top()));
+      queues_[cls].pop();
+    }
+    uint64_t start = LatencyHistogram::nowNanos();
+    queueLatency_[cls].record(start - task.enqueued);
+    task.fn(env);
+    //a failed call may leave a pending java exception behind, don't leak it into the next task
+    Tools::clearException(env);
+    uint64_t end = LatencyHistogram::nowNanos();
+    totalLatency_[cls].record(end - task.enqueued);
+    if (end > task.deadline) {
+      missedDeadlines_[cls].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  Tools::detachJniEnv();
+}
+
+size_t JvmCallScheduler::pending() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t total = 0;
+  for (const auto &queue : queues_) {
+    total += queue.size();
+  }
+  return total;
+}
+
+
+}
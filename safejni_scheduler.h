@@ -0,0 +1,129 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+#include "safejni_histogram.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+
+namespace safejni {
+
+
+#pragma mark JVM Call Scheduler
+
+//Runs JNI work on a pool of attached threads with priority classes. Each class keeps an earliest
+//deadline first queue. Reserved workers only serve their class (or a more urgent one), shared
+//workers serve the most urgent class, except that a less urgent task overdue by more than
+//starvationLimit is served first so bulk work keeps moving.
+class JvmCallScheduler {
+public:
+  enum class Priority {
+    Critical = 0,
+    Normal = 1,
+    Background = 2
+  };
+
+  static constexpr int kPriorityCount = 3;
+
+  struct Config {
+    size_t workers = 4;
+    //workers dedicated to each class, must sum to less than or equal to workers
+    size_t reserved[kPriorityCount] = {1, 0, 0};
+    //default deadline budget per class, measured from submission
+    std::chrono::microseconds budget[kPriorityCount] = {
+            std::chrono::milliseconds(16), std::chrono::milliseconds(100), std::chrono::seconds(1)};
+    std::chrono::microseconds starvationLimit = std::chrono::milliseconds(250);
+  };
+
+  JvmCallScheduler();
+
+  explicit JvmCallScheduler(const Config &config);
+
+  ~JvmCallScheduler();
+
+  JvmCallScheduler(const JvmCallScheduler &) = delete;
+
+  JvmCallScheduler &operator=(const JvmCallScheduler &) = delete;
+
+  //fn(JNIEnv *) runs on an attached worker, its result or exception lands in the future
+  template<typename F>
+  auto submit(Priority priority, F fn) -> std::future<decltype(fn(std::declval<JNIEnv *>()))> {
+    return submit(priority, config_.budget[static_cast<int>(priority)], std::move(fn));
+  }
+
+  template<typename F>
+  auto submit(Priority priority, std::chrono::microseconds budget, F fn)
+  -> std::future<decltype(fn(std::declval<JNIEnv *>()))> {
+    typedef decltype(fn(std::declval<JNIEnv *>())) R;
+    auto task = std::make_shared<std::packaged_task<R(JNIEnv *)>>(std::move(fn));
+    std::future<R> future = task->get_future();
+    enqueue(priority, budget, [task](JNIEnv *env) { (*task)(env); });
+    return future;
+  }
+
+  //time from submission to start
+  const LatencyHistogram &queueLatency(Priority priority) const {
+    return queueLatency_[static_cast<int>(priority)];
+  }
+
+  //time from submission to completion
+  const LatencyHistogram &totalLatency(Priority priority) const {
+    return totalLatency_[static_cast<int>(priority)];
+  }
+
+  uint64_t missedDeadlines(Priority priority) const {
+    return missedDeadlines_[static_cast<int>(priority)].load(std::memory_order_relaxed);
+  }
+
+  size_t pending() const;
+
+private:
+  struct Task {
+    uint64_t deadline;
+    uint64_t enqueued;
+    uint64_t sequence;
+    std::function<void(JNIEnv *)> fn;
+  };
+
+  struct LaterDeadline {
+    bool operator()(const Task &a, const Task &b) const {
+      return a.deadline != b.deadline ? a.deadline > b.deadline : a.sequence > b.sequence;
+    }
+  };
+
+  typedef std::priority_queue<Task, std::vector<Task>, LaterDeadline> TaskQueue;
+
+  void enqueue(Priority priority, std::chrono::microseconds budget, std::function<void(JNIEnv *)> fn);
+
+  //-1 when nothing is runnable for a worker limited to classes <= maxClass
+  int pickClass(int maxClass, uint64_t now) const;
+
+  void workerLoop(int maxClass);
+
+  Config config_;
+  std::vector<std::thread> threads_;
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  TaskQueue queues_[kPriorityCount];
+  uint64_t sequence_ = 0;
+  bool stopping_ = false;
+
+  LatencyHistogram queueLatency_[kPriorityCount];
+  LatencyHistogram totalLatency_[kPriorityCount];
+  std::atomic<uint64_t> missedDeadlines_[kPriorityCount] = {};
+};
+
+
+}
@@ -0,0 +1,211 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_slowcall.h"
+#include "safejni.h"
+
+#include <cstdio>
+#include <deque>
+#include <dlfcn.h>
+#include <mutex>
+
+#if defined(__has_include)
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define SAFEJNI_HAS_BACKTRACE 1
+#endif
+#endif
+
+using std::string;
+
+namespace safejni {
+
+
+std::atomic<uint64_t> SlowCallDetector::threshold_(0);
+
+namespace {
+
+const int kMaxNativeFrames = 32;
+const int kMaxJavaFrames = 32;
+
+std::mutex ringMutex;
+std::deque<SlowCallRecord> ring;
+size_t ringCapacity = 64;
+std::atomic<uint64_t> slowCallCount(0);
+std::atomic<bool> captureJavaStack(true);
+
+//Thread/StackTraceElement ids, resolved once on the first slow call
+struct StackIds {
+  jclass threadClass = nullptr;
+  jmethodID currentThread = nullptr;
+  jmethodID getStackTrace = nullptr;
+  jmethodID elementToString = nullptr;
+};
+
+const StackIds *stackIds(JNIEnv *env) {
+  static std::once_flag once;
+  static StackIds ids;
+  std::call_once(once, [env]() {
+    jclass threadClass = env->FindClass("java/lang/Thread");
+    jclass elementClass = env->FindClass("java/lang/StackTraceElement");
+    if (threadClass && elementClass) {
+      ids.currentThread = env->GetStaticMethodID(threadClass, "currentThread", "()Ljava/lang/Thread;");
+      ids.getStackTrace = env->GetMethodID(threadClass, "getStackTrace",
+                                           "()[Ljava/lang/StackTraceElement;");
+      ids.elementToString = env->GetMethodID(elementClass, "toString", "()Ljava/lang/String;");
+      ids.threadClass = static_cast<jclass>(env->NewGlobalRef(threadClass));
+    }
+    env->ExceptionClear();
+    if (threadClass) {
+      env->DeleteLocalRef(threadClass);
+    }
+    if (elementClass) {
+      env->DeleteLocalRef(elementClass);
+    }
+  });
+  return ids.threadClass && ids.currentThread && ids.getStackTrace && ids.elementToString ? &ids
+                                                                                          : nullptr;
+}
+
+//raw JNI on purpose: nothing here may go through the instrumented call paths or throw
+void captureJavaFrames(std::vector<string> &frames) {
+  JNIEnv *env = Tools::attachJniEnv();
+  if (!env || env->ExceptionCheck()) {
+    return;
+  }
+  const StackIds *ids = stackIds(env);
+  if (!ids) {
+    return;
+  }
+  if (env->PushLocalFrame(kMaxJavaFrames + 4) != 0) {
+    env->ExceptionClear();
+    return;
+  }
+  jobject thread = env->CallStaticObjectMethod(ids->threadClass, ids->currentThread);
+  auto elements = thread ? static_cast<jobjectArray>(env->CallObjectMethod(thread, ids->getStackTrace))
+                         : nullptr;
+  if (elements && !env->ExceptionCheck()) {
+    jsize length = env->GetArrayLength(elements);
+    for (jsize i = 0; i < length && i < kMaxJavaFrames; ++i) {
+      jobject element = env->GetObjectArrayElement(elements, i);
+      auto text = element ? static_cast<jstring>(env->CallObjectMethod(element, ids->elementToString))
+                          : nullptr;
+      if (env->ExceptionCheck()) {
+        break;
+      }
+      if (text) {
+        const char *chars = env->GetStringUTFChars(text, nullptr);
+        if (chars) {
+          frames.push_back(chars);
+          env->ReleaseStringUTFChars(text, chars);
+        }
+        env->DeleteLocalRef(text);
+      }
+      env->DeleteLocalRef(element);
+    }
+  }
+  env->ExceptionClear();
+  env->PopLocalFrame(nullptr);
+}
+
+}
+
+void SlowCallDetector::setCapacity(size_t capacity) {
+  std::lock_guard<std::mutex> lock(ringMutex);
+  ringCapacity = capacity;
+  while (ring.size() > ringCapacity) {
+    ring.pop_front();
+  }
+}
+
+void SlowCallDetector::setCaptureJavaStack(bool capture) {
+  captureJavaStack.store(capture, std::memory_order_relaxed);
+}
+
+std::vector<SlowCallRecord> SlowCallDetector::records() {
+  std::lock_guard<std::mutex> lock(ringMutex);
+  return std::vector<SlowCallRecord>(ring.begin(), ring.end());
+}
+
+uint64_t SlowCallDetector::slowCalls() {
+  return slowCallCount.load(std::memory_order_relaxed);
+}
+
+void SlowCallDetector::clear() {
+  std::lock_guard<std::mutex> lock(ringMutex);
+  ring.clear();
+}
+
+void SlowCallDetector::report(SlowCallRecord &&record) {
+  slowCallCount.fetch_add(1, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(ringMutex);
+  if (ringCapacity == 0) {
+    return;
+  }
+  if (ring.size() >= ringCapacity) {
+    ring.pop_front();
+  }
+  ring.push_back(std::move(record));
+}
+
+string SlowCallDetector::describe(const SlowCallRecord &record) {
+  char line[256];
+  snprintf(line, sizeof(line), "slow %s %s%s%s%s took %.3fms, argument sizes [",
+           record.kind.c_str(), record.className.c_str(), record.className.empty() ? "" : ".",
+           record.method.c_str(), record.signature.c_str(), record.elapsedNanos / 1e6);
+  string text = line;
+  for (size_t i = 0; i < record.argumentSizes.size(); ++i) {
+    text += (i ? ", " : "") + std::to_string(record.argumentSizes[i]);
+  }
+  text += "]\n";
+  for (void *frame : record.nativeFrames) {
+    Dl_info info;
+    if (dladdr(frame, &info) && info.dli_sname) {
+      snprintf(line, sizeof(line), "  native %p %s+%#lx (%s)\n", frame, info.dli_sname,
+               static_cast<unsigned long>(static_cast<char *>(frame) -
+                                          static_cast<char *>(info.dli_saddr)),
+               info.dli_fname);
+    } else {
+      snprintf(line, sizeof(line), "  native %p\n", frame);
+    }
+    text += line;
+  }
+  for (const string &frame : record.javaFrames) {
+    text += "  java   at " + frame + "\n";
+  }
+  return text;
+}
+
+// SlowCallScope
+
+void SlowCallScope::slow(uint64_t elapsed) {
+  //runs from a destructor, possibly while a JNIException unwinds
+  try {
+    SlowCallRecord record;
+    record.kind = kind_;
+    record.className = className_ ? className_ : "";
+    record.method = method_ ? method_ : "";
+    record.signature = signature_ ? signature_ : "";
+    record.elapsedNanos = elapsed;
+    if (sizer_) {
+      sizer_(arguments_, record.argumentSizes);
+    }
+#ifdef SAFEJNI_HAS_BACKTRACE
+    record.nativeFrames.resize(kMaxNativeFrames);
+    int depth = backtrace(record.nativeFrames.data(), kMaxNativeFrames);
+    record.nativeFrames.resize(depth > 0 ? depth : 0);
+#endif
+    if (captureJavaStack.load(std::memory_order_relaxed)) {
+      captureJavaFrames(record.javaFrames);
+    }
+    SlowCallDetector::report(std::move(record));
+  } catch (...) {
+  }
+}
+
+
+}
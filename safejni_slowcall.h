@@ -0,0 +1,154 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni_histogram.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+
+namespace safejni {
+
+
+#pragma mark Slow Call Detector
+
+struct SlowCallRecord {
+  std::string kind;
+  std::string className;
+  std::string method;
+  std::string signature;
+  uint64_t elapsedNanos = 0;
+  //marshalled size of each argument: bytes for strings and vectors, entries for maps
+  std::vector<long> argumentSizes;
+  std::vector<void *> nativeFrames;
+  std::vector<std::string> javaFrames;
+};
+
+//Threshold based detector on the safejni call paths. Under the threshold a call costs two
+//clock reads and a comparison; over it the method, argument sizes, native backtrace and the
+//java stack (Thread.getStackTrace, with cached ids) are captured into a bounded ring.
+class SlowCallDetector {
+public:
+  //0 disables the detector
+  static void setThresholdNanos(uint64_t nanos) {
+    threshold_.store(nanos, std::memory_order_relaxed);
+  }
+
+  static uint64_t thresholdNanos() { return threshold_.load(std::memory_order_relaxed); }
+
+  //number of records kept, the oldest are overwritten
+  static void setCapacity(size_t capacity);
+
+  static void setCaptureJavaStack(bool capture);
+
+  //oldest first
+  static std::vector<SlowCallRecord> records();
+
+  //slow calls seen so far, including the ones overwritten in the ring
+  static uint64_t slowCalls();
+
+  static void clear();
+
+  //human readable record with symbolized native frames
+  static std::string describe(const SlowCallRecord &record);
+
+  static void report(SlowCallRecord &&record);
+
+private:
+  static std::atomic<uint64_t> threshold_;
+};
+
+inline long jniArgumentSize(const std::string &value) { return static_cast<long>(value.size()); }
+
+inline long jniArgumentSize(const char *value) { return value ? static_cast<long>(strlen(value)) : 0; }
+
+template<typename T>
+long jniArgumentSize(const std::vector<T> &value) { return static_cast<long>(value.size() * sizeof(T)); }
+
+template<typename K, typename V>
+long jniArgumentSize(const std::map<K, V> &value) { return static_cast<long>(value.size()); }
+
+template<typename T>
+long jniArgumentSize(const T &) { return static_cast<long>(sizeof(T)); }
+
+//references to the call arguments, sized only when the call turns out slow
+template<typename... Args>
+struct SlowCallArguments {
+  explicit SlowCallArguments(const Args &... v) : values(v...) {}
+
+  void operator()(std::vector<long> &out) const { append<0>(out); }
+
+  template<size_t I>
+  typename std::enable_if<(I < sizeof...(Args))>::type append(std::vector<long> &out) const {
+    out.push_back(jniArgumentSize(std::get<I>(values)));
+    append<I + 1>(out);
+  }
+
+  template<size_t I>
+  typename std::enable_if<(I == sizeof...(Args))>::type append(std::vector<long> &) const {}
+
+  std::tuple<const Args &...> values;
+};
+
+class SlowCallScope {
+public:
+  SlowCallScope(const char *kind, const char *className, const char *method,
+                const char *signature)
+          : threshold_(SlowCallDetector::thresholdNanos()), kind_(kind), className_(className),
+            method_(method), signature_(signature) {
+    if (threshold_) {
+      start_ = LatencyHistogram::nowNanos();
+    }
+  }
+
+  ~SlowCallScope() {
+    if (threshold_) {
+      uint64_t elapsed = LatencyHistogram::nowNanos() - start_;
+      if (elapsed >= threshold_) {
+        slow(elapsed);
+      }
+    }
+  }
+
+  SlowCallScope(const SlowCallScope &) = delete;
+
+  SlowCallScope &operator=(const SlowCallScope &) = delete;
+
+  //`sizes` is called as sizes(std::vector<long>&) on the slow path only, it must outlive the scope
+  template<typename F>
+  void setArguments(const F *sizes) {
+    arguments_ = sizes;
+    sizer_ = &sizeArguments<F>;
+  }
+
+private:
+  template<typename F>
+  static void sizeArguments(const void *sizes, std::vector<long> &out) {
+    (*static_cast<const F *>(sizes))(out);
+  }
+
+  void slow(uint64_t elapsed);
+
+  uint64_t threshold_;
+  uint64_t start_ = 0;
+  const char *kind_;
+  const char *className_;
+  const char *method_;
+  const char *signature_;
+  const void *arguments_ = nullptr;
+  void (*sizer_)(const void *, std::vector<long> &) = nullptr;
+};
+
+
+}
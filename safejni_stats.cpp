@@ -0,0 +1,253 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_stats.h"
+#include "safejni.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <unistd.h>
+
+using std::string;
+
+namespace safejni {
+
+
+StatsRegistry &StatsRegistry::shared() {
+  static StatsRegistry registry;
+  return registry;
+}
+
+const char *StatsRegistry::coreName(CoreMetric metric) {
+  switch (metric) {
+    case CoreMetric::Attaches:
+      return "safejni_attaches_total";
+    case CoreMetric::MethodLookups:
+      return "safejni_method_lookups_total";
+    case CoreMetric::FieldLookups:
+      return "safejni_field_lookups_total";
+    case CoreMetric::ArrayPoolHits:
+      return "safejni_array_pool_hits_total";
+    case CoreMetric::ArrayPoolMisses:
+      return "safejni_array_pool_misses_total";
+    case CoreMetric::LiveGlobalRefs:
+      return "safejni_live_global_refs";
+    case CoreMetric::BytesToJava:
+      return "safejni_bytes_to_java_total";
+    case CoreMetric::BytesFromJava:
+      return "safejni_bytes_from_java_total";
+    case CoreMetric::JavaExceptions:
+      return "safejni_java_exceptions_total";
+    case CoreMetric::Count:
+      break;
+  }
+  return "safejni_unknown";
+}
+
+int StatsRegistry::addCollector(Collector collector) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int id = nextCollector_++;
+  collectors_.emplace_back(id, std::move(collector));
+  return id;
+}
+
+void StatsRegistry::removeCollector(int id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = collectors_.begin(); it != collectors_.end(); ++it) {
+    if (it->first == id) {
+      collectors_.erase(it);
+      return;
+    }
+  }
+}
+
+std::vector<MetricSample> StatsRegistry::snapshot() const {
+  std::vector<MetricSample> samples;
+  for (int i = 0; i < static_cast<int>(CoreMetric::Count); ++i) {
+    CoreMetric metric = static_cast<CoreMetric>(i);
+    samples.push_back({coreName(metric), core_[i].value(), metric != CoreMetric::LiveGlobalRefs});
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &collector : collectors_) {
+    collector.second(samples);
+  }
+  return samples;
+}
+
+namespace {
+
+bool endsWith(const string &text, const string &suffix) {
+  return text.size() > suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+//metric name without labels, and without the _sum/_count suffix of summary samples
+string familyOf(const MetricSample &sample) {
+  string name = sample.name.substr(0, sample.name.find('{'));
+  if (sample.type && strcmp(sample.type, "summary") == 0) {
+    if (endsWith(name, "_sum")) {
+      name.resize(name.size() - 4);
+    } else if (endsWith(name, "_count")) {
+      name.resize(name.size() - 6);
+    }
+  }
+  return name;
+}
+
+}
+
+string StatsRegistry::toPrometheus() const {
+  //the exposition format wants every sample of a family together under one TYPE line, while
+  //collectors may interleave families (e.g. all metrics of one site, then the next site)
+  std::vector<MetricSample> samples = snapshot();
+  std::vector<string> order;
+  std::map<string, std::vector<const MetricSample *>> families;
+  for (const MetricSample &sample : samples) {
+    string family = familyOf(sample);
+    std::vector<const MetricSample *> &members = families[family];
+    if (members.empty()) {
+      order.push_back(family);
+    }
+    members.push_back(&sample);
+  }
+
+  string text;
+  char line[64];
+  for (const string &family : order) {
+    const std::vector<const MetricSample *> &members = families[family];
+    const MetricSample &first = *members.front();
+    text += "# TYPE " + family + " " + (first.type ? first.type : first.counter ? "counter" : "gauge") + "\n";
+    for (const MetricSample *sample : members) {
+      snprintf(line, sizeof(line), " %lld\n", static_cast<long long>(sample->value));
+      text += sample->name + line;
+    }
+  }
+  return text;
+}
+
+bool StatsRegistry::dumpPrometheus(const string &path) const {
+  string text = toPrometheus();
+  string temporary = path + ".tmp";
+  FILE *file = fopen(temporary.c_str(), "w");
+  if (!file) {
+    return false;
+  }
+  bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+//called from a catch block: leaves the C++ exception pending in java instead of unwinding
+//through the JNI frame
+void throwPending(JNIEnv *env) {
+  string message = "unknown native exception";
+  try {
+    throw;
+  } catch (const std::exception &e) {
+    message = e.what();
+  } catch (...) {
+  }
+  if (!env->ExceptionCheck()) {
+    jclass error = env->FindClass("java/lang/RuntimeException");
+    env->ThrowNew(error, message.c_str());
+    env->DeleteLocalRef(error);
+  }
+}
+
+jobjectArray JNICALL nativeNames(JNIEnv *env, jclass) {
+  try {
+    std::vector<string> names;
+    for (const MetricSample &sample : StatsRegistry::shared().snapshot()) {
+      names.push_back(sample.name);
+    }
+    return Tools::toJObjectArray(env, names);
+  } catch (...) {
+    throwPending(env);
+    return nullptr;
+  }
+}
+
+jlongArray JNICALL nativeSnapshot(JNIEnv *env, jclass) {
+  try {
+    std::vector<MetricSample> samples = StatsRegistry::shared().snapshot();
+    std::vector<jlong> values(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+      values[i] = samples[i].value;
+    }
+    jlongArray array = env->NewLongArray(static_cast<jsize>(values.size()));
+    if (array && !values.empty()) {
+      env->SetLongArrayRegion(array, 0, static_cast<jsize>(values.size()), values.data());
+    }
+    return array;
+  } catch (...) {
+    throwPending(env);
+    return nullptr;
+  }
+}
+
+jint JNICALL nativeSnapshotInto(JNIEnv *env, jclass, jobject buffer) {
+  try {
+    auto *address = static_cast<uint8_t *>(env->GetDirectBufferAddress(buffer));
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    std::vector<MetricSample> samples = StatsRegistry::shared().snapshot();
+    if (address && capacity > 0) {
+      size_t fit = std::min<size_t>(samples.size(), static_cast<size_t>(capacity) / sizeof(int64_t));
+      for (size_t i = 0; i < fit; ++i) {
+        int64_t value = samples[i].value;
+        memcpy(address + i * sizeof(int64_t), &value, sizeof(value));
+      }
+    }
+    return static_cast<jint>(samples.size());
+  } catch (...) {
+    throwPending(env);
+    return 0;
+  }
+}
+
+jboolean JNICALL nativeDump(JNIEnv *env, jclass, jstring path) {
+  try {
+    return StatsRegistry::shared().dumpPrometheus(Tools::toString(env, path)) ? JNI_TRUE : JNI_FALSE;
+  } catch (...) {
+    throwPending(env);
+    return JNI_FALSE;
+  }
+}
+
+}
+
+void StatsRegistry::registerNatives(JNIEnv *env, const char *className) {
+  static JNINativeMethod methods[] = {
+          {const_cast<char *>("names"), const_cast<char *>("()[Ljava/lang/String;"),
+                  reinterpret_cast<void *>(nativeNames)},
+          {const_cast<char *>("snapshot"), const_cast<char *>("()[J"),
+                  reinterpret_cast<void *>(nativeSnapshot)},
+          {const_cast<char *>("snapshotInto"), const_cast<char *>("(Ljava/nio/ByteBuffer;)I"),
+                  reinterpret_cast<void *>(nativeSnapshotInto)},
+          {const_cast<char *>("dump"), const_cast<char *>("(Ljava/lang/String;)Z"),
+                  reinterpret_cast<void *>(nativeDump)},
+  };
+  jclass clazz = env->FindClass(className);
+  Tools::checkException(env);
+  if (!clazz) {
+    throw JNIException(string("Could not find the given class: ") + className);
+  }
+  jint status = env->RegisterNatives(clazz, methods, sizeof(methods) / sizeof(methods[0]));
+  env->DeleteLocalRef(clazz);
+  if (status < 0) {
+    Tools::checkException(env);
+    throw JNIException("register failed");
+  }
+}
+
+
+}
@@ -0,0 +1,131 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include <jni.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace safejni {
+
+
+#pragma mark Sharded Counters
+
+//Counter split over cache line sized shards. Each thread sticks to one shard (handed out round
+//robin), so hot counters bumped from many threads do not bounce one cache line around.
+//Signed, so it also serves as a gauge through add(-n).
+class ShardedCounter {
+public:
+  static constexpr int kShards = 16;
+
+  void add(int64_t n = 1) {
+    shards_[threadShard()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  int64_t value() const {
+    int64_t total = 0;
+    for (const Shard &shard : shards_) {
+      total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  static int threadShard() {
+    static std::atomic<unsigned> next(0);
+    thread_local int shard = static_cast<int>(next.fetch_add(1, std::memory_order_relaxed) % kShards);
+    return shard;
+  }
+
+private:
+  struct alignas(64) Shard {
+    std::atomic<int64_t> value{0};
+  };
+
+  Shard shards_[kShards];
+};
+
+#pragma mark Stats Registry
+
+enum class CoreMetric {
+  Attaches,
+  MethodLookups,
+  FieldLookups,
+  ArrayPoolHits,
+  ArrayPoolMisses,
+  LiveGlobalRefs,
+  BytesToJava,
+  BytesFromJava,
+  JavaExceptions,
+  Count
+};
+
+struct MetricSample {
+  std::string name;
+  int64_t value;
+  //counters only go up, everything else is reported as a gauge
+  bool counter;
+  //overrides the prometheus type, e.g. "summary" for the quantile, _sum and _count samples of
+  //one summary family
+  const char *type = nullptr;
+};
+
+//Process wide metrics: fixed core counters bumped from the hot paths, plus collectors that
+//other components register to publish their own numbers in the same snapshot.
+class StatsRegistry {
+public:
+  typedef std::function<void(std::vector<MetricSample> &out)> Collector;
+
+  static StatsRegistry &shared();
+
+  void count(CoreMetric metric, int64_t n = 1) {
+    core_[static_cast<int>(metric)].add(n);
+  }
+
+  int64_t value(CoreMetric metric) const {
+    return core_[static_cast<int>(metric)].value();
+  }
+
+  //returns an id for removeCollector
+  int addCollector(Collector collector);
+
+  void removeCollector(int id);
+
+  //core metrics first, then every collector in registration order
+  std::vector<MetricSample> snapshot() const;
+
+  //Prometheus text exposition format
+  std::string toPrometheus() const;
+
+  //writes toPrometheus() to path through a temporary file and a rename, so scrapers never see
+  //a partial file
+  bool dumpPrometheus(const std::string &path) const;
+
+  //registers the natives of safejni.Stats (names, snapshot, snapshotInto, dump)
+  static void registerNatives(JNIEnv *env, const char *className = "safejni/Stats");
+
+  static const char *coreName(CoreMetric metric);
+
+private:
+  ShardedCounter core_[static_cast<int>(CoreMetric::Count)];
+  mutable std::mutex mutex_;
+  std::vector<std::pair<int, Collector>> collectors_;
+  int nextCollector_ = 0;
+};
+
+inline void countStat(CoreMetric metric, int64_t n = 1) {
+  StatsRegistry::shared().count(metric, n);
+}
+
+
+}
@@ -0,0 +1,235 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+
+#include "safejni_stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+namespace safejni {
+
+
+namespace {
+
+//InputStream and OutputStream live in the boot class loader, their method ids never go stale
+jmethodID cachedMethod(JNIEnv *env, const char *className, const char *name, const char *signature) {
+  SPJNIMethodInfo info = Tools::getMethodInfo(env, className, name, signature);
+  return info->methodId;
+}
+
+jmethodID inputStreamRead(JNIEnv *env) {
+  static jmethodID methodId = cachedMethod(env, "java/io/InputStream", "read", "([BII)I");
+  return methodId;
+}
+
+jmethodID outputStreamWrite(JNIEnv *env) {
+  static jmethodID methodId = cachedMethod(env, "java/io/OutputStream", "write", "([BII)V");
+  return methodId;
+}
+
+jmethodID outputStreamFlush(JNIEnv *env) {
+  static jmethodID methodId = cachedMethod(env, "java/io/OutputStream", "flush", "()V");
+  return methodId;
+}
+
+//InputStream.read returns 0 for a non-empty request only on broken streams, give up after this
+//many in a row instead of spinning
+const int kMaxZeroReads = 16;
+
+uint64_t nowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+JavaStreamBufBase::JavaStreamBufBase(jobject stream, size_t chunkSize, JavaByteArrayPool *pool)
+        : stream_(nullptr), chunk_(nullptr), chunkSize_(std::max<size_t>(chunkSize, 1)),
+          pool_(pool) {
+  JNIEnv *env = Tools::attachJniEnv();
+  if (!stream) {
+    throw JNIException("JavaStreamBuf: null java stream");
+  }
+  stream_ = env->NewGlobalRef(stream);
+  if (pool_) {
+    chunk_ = pool_->acquire(env, static_cast<jsize>(chunkSize_));
+  } else {
+    jbyteArray local = env->NewByteArray(static_cast<jsize>(chunkSize_));
+    Tools::checkException(env);
+    chunk_ = static_cast<jbyteArray>(env->NewGlobalRef(local));
+    env->DeleteLocalRef(local);
+  }
+  buffer_.resize(chunkSize_);
+}
+
+JavaStreamBufBase::~JavaStreamBufBase() {
+  JNIEnv *env = Tools::attachJniEnv();
+  if (chunk_) {
+    if (pool_) {
+      pool_->release(env, chunk_);
+    } else {
+      env->DeleteGlobalRef(chunk_);
+    }
+  }
+  if (stream_) {
+    env->DeleteGlobalRef(stream_);
+  }
+}
+
+// JavaInputStreamBuf
+
+JavaInputStreamBuf::JavaInputStreamBuf(jobject inputStream, size_t chunkSize,
+                                       JavaByteArrayPool *pool)
+        : JavaStreamBufBase(inputStream, chunkSize, pool) {
+  setg(buffer_.data(), buffer_.data(), buffer_.data());
+}
+
+jint JavaInputStreamBuf::readChunk(JNIEnv *env, jint length) {
+  uint64_t start = nowNanos();
+  jint count = env->CallIntMethod(stream_, inputStreamRead(env), chunk_, 0, length);
+  Tools::checkException(env);
+  stats_.javaNanos += nowNanos() - start;
+  stats_.javaCalls++;
+  if (count > 0) {
+    stats_.bytes += count;
+  }
+  return count;
+}
+
+JavaInputStreamBuf::int_type JavaInputStreamBuf::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  JNIEnv *env = Tools::attachJniEnv();
+  jint count = readChunk(env, static_cast<jint>(chunkSize_));
+  for (int zeroReads = 1; count == 0; ++zeroReads) {
+    if (zeroReads == kMaxZeroReads) {
+      throw JNIException("JavaInputStreamBuf: InputStream.read returned 0 " +
+                         std::to_string(kMaxZeroReads) + " times in a row");
+    }
+    count = readChunk(env, static_cast<jint>(chunkSize_));
+  }
+  if (count < 0) {
+    return traits_type::eof();
+  }
+  env->GetByteArrayRegion(chunk_, 0, count, reinterpret_cast<jbyte *>(buffer_.data()));
+  setg(buffer_.data(), buffer_.data(), buffer_.data() + count);
+  return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize JavaInputStreamBuf::xsgetn(char *s, std::streamsize n) {
+  std::streamsize done = 0;
+  //drain what is already buffered
+  std::streamsize buffered = std::min<std::streamsize>(egptr() - gptr(), n);
+  if (buffered > 0) {
+    std::memcpy(s, gptr(), buffered);
+    gbump(static_cast<int>(buffered));
+    done += buffered;
+  }
+  //large reads skip the native buffer and copy from the java chunk straight into `s`
+  JNIEnv *env = nullptr;
+  while (n - done >= static_cast<std::streamsize>(chunkSize_)) {
+    if (!env) {
+      env = Tools::attachJniEnv();
+    }
+    jint count = readChunk(env, static_cast<jint>(chunkSize_));
+    if (count < 0) {
+      return done;
+    }
+    if (count == 0) {
+      //underflow bounds the retries
+      break;
+    }
+    env->GetByteArrayRegion(chunk_, 0, count, reinterpret_cast<jbyte *>(s + done));
+    done += count;
+  }
+  while (done < n) {
+    if (traits_type::eq_int_type(underflow(), traits_type::eof())) {
+      break;
+    }
+    std::streamsize step = std::min<std::streamsize>(egptr() - gptr(), n - done);
+    std::memcpy(s + done, gptr(), step);
+    gbump(static_cast<int>(step));
+    done += step;
+  }
+  return done;
+}
+
+// JavaOutputStreamBuf
+
+JavaOutputStreamBuf::JavaOutputStreamBuf(jobject outputStream, size_t chunkSize,
+                                         JavaByteArrayPool *pool)
+        : JavaStreamBufBase(outputStream, chunkSize, pool) {
+  setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+JavaOutputStreamBuf::~JavaOutputStreamBuf() {
+  try {
+    sync();
+  } catch (const JNIException &) {
+    //already logged by JNIException, destructors must not throw
+  }
+}
+
+void JavaOutputStreamBuf::writeChunk(JNIEnv *env, const char *data, jint length) {
+  env->SetByteArrayRegion(chunk_, 0, length, reinterpret_cast<const jbyte *>(data));
+  uint64_t start = nowNanos();
+  env->CallVoidMethod(stream_, outputStreamWrite(env), chunk_, 0, length);
+  Tools::checkException(env);
+  stats_.javaNanos += nowNanos() - start;
+  stats_.javaCalls++;
+  stats_.bytes += length;
+}
+
+bool JavaOutputStreamBuf::flushBuffer() {
+  std::ptrdiff_t pending = pptr() - pbase();
+  if (pending > 0) {
+    writeChunk(Tools::attachJniEnv(), pbase(), static_cast<jint>(pending));
+  }
+  setp(buffer_.data(), buffer_.data() + buffer_.size());
+  return true;
+}
+
+JavaOutputStreamBuf::int_type JavaOutputStreamBuf::overflow(int_type ch) {
+  flushBuffer();
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+std::streamsize JavaOutputStreamBuf::xsputn(const char *s, std::streamsize n) {
+  std::streamsize room = epptr() - pptr();
+  if (n <= room) {
+    std::memcpy(pptr(), s, n);
+    pbump(static_cast<int>(n));
+    return n;
+  }
+  flushBuffer();
+  JNIEnv *env = Tools::attachJniEnv();
+  std::streamsize done = 0;
+  while (n - done >= static_cast<std::streamsize>(chunkSize_)) {
+    writeChunk(env, s + done, static_cast<jint>(chunkSize_));
+    done += chunkSize_;
+  }
+  std::memcpy(pptr(), s + done, n - done);
+  pbump(static_cast<int>(n - done));
+  return n;
+}
+
+int JavaOutputStreamBuf::sync() {
+  flushBuffer();
+  JNIEnv *env = Tools::attachJniEnv();
+  env->CallVoidMethod(stream_, outputStreamFlush(env));
+  Tools::checkException(env);
+  return 0;
+}
+
+
+}
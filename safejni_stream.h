@@ -0,0 +1,123 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+#pragma once
+
+#include "safejni.h"
+#include "safejni_arraypool.h"
+
+#include <istream>
+#include <ostream>
+#include <streambuf>
+
+
+namespace safejni {
+
+
+#pragma mark Java Stream Buffers
+
+struct JavaStreamStats {
+  uint64_t bytes = 0;
+  uint64_t javaCalls = 0;
+  uint64_t javaNanos = 0;
+
+  double bytesPerSecond() const {
+    return javaNanos ? bytes * 1e9 / javaNanos : 0.0;
+  }
+};
+
+//Shared plumbing: a java stream global ref, one reusable byte[] chunk and a native copy of it.
+//When a pool is given the chunk is borrowed from it and returned on destruction.
+class JavaStreamBufBase {
+public:
+  const JavaStreamStats &stats() const { return stats_; }
+
+  size_t chunkSize() const { return chunkSize_; }
+
+protected:
+  JavaStreamBufBase(jobject stream, size_t chunkSize, JavaByteArrayPool *pool);
+
+  ~JavaStreamBufBase();
+
+  JavaStreamBufBase(const JavaStreamBufBase &) = delete;
+
+  JavaStreamBufBase &operator=(const JavaStreamBufBase &) = delete;
+
+  jobject stream_;
+  jbyteArray chunk_;
+  size_t chunkSize_;
+  JavaByteArrayPool *pool_;
+  std::vector<char> buffer_;
+  JavaStreamStats stats_;
+};
+
+//std::streambuf reading from a java.io.InputStream
+class JavaInputStreamBuf : public std::streambuf, public JavaStreamBufBase {
+public:
+  explicit JavaInputStreamBuf(jobject inputStream, size_t chunkSize = 64 * 1024,
+                              JavaByteArrayPool *pool = nullptr);
+
+protected:
+  int_type underflow() override;
+
+  std::streamsize xsgetn(char *s, std::streamsize n) override;
+
+private:
+  //one InputStream.read into the java chunk, returns the byte count or -1 at end of stream
+  jint readChunk(JNIEnv *env, jint length);
+};
+
+//std::streambuf writing to a java.io.OutputStream, sync() also flushes the java stream
+class JavaOutputStreamBuf : public std::streambuf, public JavaStreamBufBase {
+public:
+  explicit JavaOutputStreamBuf(jobject outputStream, size_t chunkSize = 64 * 1024,
+                               JavaByteArrayPool *pool = nullptr);
+
+  ~JavaOutputStreamBuf() override;
+
+protected:
+  int_type overflow(int_type ch) override;
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override;
+
+  int sync() override;
+
+private:
+  void writeChunk(JNIEnv *env, const char *data, jint length);
+
+  bool flushBuffer();
+};
+
+class JavaInputStream : public std::istream {
+public:
+  explicit JavaInputStream(jobject inputStream, size_t chunkSize = 64 * 1024,
+                           JavaByteArrayPool *pool = nullptr)
+          : std::istream(nullptr), buf_(inputStream, chunkSize, pool) {
+    rdbuf(&buf_);
+  }
+
+  const JavaStreamStats &stats() const { return buf_.stats(); }
+
+private:
+  JavaInputStreamBuf buf_;
+};
+
+class JavaOutputStream : public std::ostream {
+public:
+  explicit JavaOutputStream(jobject outputStream, size_t chunkSize = 64 * 1024,
+                            JavaByteArrayPool *pool = nullptr)
+          : std::ostream(nullptr), buf_(outputStream, chunkSize, pool) {
+    rdbuf(&buf_);
+  }
+
+  const JavaStreamStats &stats() const { return buf_.stats(); }
+
+private:
+  JavaOutputStreamBuf buf_;
+};
+
+
+}
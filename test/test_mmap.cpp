@@ -0,0 +1,173 @@
+/*
+ * SafeJNI is licensed under MIT licensed. See LICENSE.md file for more information.
+ * Copyright (c) 2014 MortimerGoro
+ * Copyright (c) 2019 xqyphp
+*/
+
+//MappedFile tests on local temp files, they never touch a JVM.
+//
+//Build against a desktop JDK (headers only), e.g.:
+//  g++ -std=c++14 -I. -I$JAVA_HOME/include -I$JAVA_HOME/include/linux
+//      test/test_mmap.cpp safejni_mmap.cpp safejni.cpp safejni_stats.cpp safejni_cputime.cpp
+//      safejni_slowcall.cpp safejni_resolution.cpp safejni_adaptive.cpp safejni_critical.cpp
+//      -ldl -pthread -o test_mmap
+//  ./test_mmap
+
+#include "safejni_mmap.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+using namespace safejni;
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+template<typename F>
+bool throwsJNIException(F fn) {
+  try {
+    fn();
+  } catch (const JNIException &) {
+    return true;
+  }
+  return false;
+}
+
+//a file in $TMPDIR holding `size` bytes of a known pattern, removed on destruction
+class TempFile {
+public:
+  explicit TempFile(size_t size) {
+    const char *dir = getenv("TMPDIR");
+    path_ = std::string(dir ? dir : "/tmp") + "/safejni_mmap_XXXXXX";
+    int fd = mkstemp(&path_[0]);
+    if (fd < 0) {
+      perror("mkstemp");
+      exit(1);
+    }
+    std::string content(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+      content[i] = static_cast<char>(i * 31 + 7);
+    }
+    if (write(fd, content.data(), content.size()) != static_cast<ssize_t>(content.size())) {
+      perror("write");
+      exit(1);
+    }
+    close(fd);
+  }
+
+  ~TempFile() {
+    unlink(path_.c_str());
+  }
+
+  const std::string &path() const { return path_; }
+
+private:
+  std::string path_;
+};
+
+void testOpen() {
+  TempFile file(10000);
+  MappedFilePtr mapped = MappedFile::Open(file.path());
+  EXPECT(mapped->size() == 10000);
+  EXPECT(mapped->data()[0] == 7);
+  EXPECT(mapped->data()[9999] == static_cast<uint8_t>(9999 * 31 + 7));
+  EXPECT(mapped->mutableData() == nullptr);
+
+  EXPECT(throwsJNIException([&] { MappedFile::Open(file.path() + ".missing"); }));
+}
+
+void testEmpty() {
+  TempFile file(0);
+  MappedFilePtr mapped = MappedFile::Open(file.path());
+  EXPECT(mapped->size() == 0);
+  EXPECT(mapped->data() == nullptr);
+  mapped->advise(MappedFile::Advice::WillNeed);
+}
+
+void testWritable() {
+  TempFile file(4096);
+  {
+    MappedFilePtr mapped = MappedFile::Open(file.path(), true);
+    EXPECT(mapped->mutableData() != nullptr);
+    mapped->mutableData()[100] = 0xab;
+  }
+  MappedFilePtr reopened = MappedFile::Open(file.path());
+  EXPECT(reopened->data()[100] == 0xab);
+}
+
+void testAdvise() {
+  size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  TempFile file(pageSize * 4 + 123);
+  MappedFilePtr mapped = MappedFile::Open(file.path());
+  mapped->advise(MappedFile::Advice::Sequential);
+  mapped->advise(MappedFile::Advice::Random, 1, 10);
+  //unaligned starts are rounded down to the page
+  mapped->advise(MappedFile::Advice::WillNeed, pageSize + 17, pageSize);
+  mapped->advise(MappedFile::Advice::DontNeed, pageSize * 4);
+  mapped->advise(MappedFile::Advice::Normal);
+  //DontNeed on a shared file mapping must leave the contents intact
+  EXPECT(mapped->data()[pageSize * 4 + 1] == static_cast<uint8_t>((pageSize * 4 + 1) * 31 + 7));
+}
+
+void testRanges() {
+  TempFile file(1000);
+  MappedFilePtr mapped = MappedFile::Open(file.path());
+  EXPECT(!throwsJNIException([&] { mapped->advise(MappedFile::Advice::Normal, 1000); }));
+  EXPECT(!throwsJNIException([&] { mapped->advise(MappedFile::Advice::Normal, 0, 1000); }));
+  EXPECT(!throwsJNIException([&] { mapped->advise(MappedFile::Advice::Normal, 999, 1); }));
+  EXPECT(throwsJNIException([&] { mapped->advise(MappedFile::Advice::Normal, 1001); }));
+  EXPECT(throwsJNIException([&] { mapped->advise(MappedFile::Advice::Normal, 0, 1001); }));
+  EXPECT(throwsJNIException([&] { mapped->advise(MappedFile::Advice::Normal, 999, 2); }));
+  EXPECT(throwsJNIException([&] { mapped->advise(MappedFile::Advice::Normal, 500, SIZE_MAX); }));
+  //checked before any JNI work
+  EXPECT(throwsJNIException([&] { mapped->toRegion(1001); }));
+  EXPECT(throwsJNIException([&] { mapped->toByteBuffer(0, 2000); }));
+}
+
+void testHandles() {
+  TempFile file(100);
+  MappedFilePtr mapped = MappedFile::Open(file.path());
+  EXPECT(MappedFile::FromHandle(0) == nullptr);
+  jlong first = MappedFile::Retain(mapped);
+  jlong second = MappedFile::Retain(mapped);
+  EXPECT(MappedFile::FromHandle(first) == mapped);
+  EXPECT(mapped.use_count() == 3);
+
+  //the handles keep the mapping alive without the original pointer
+  std::weak_ptr<MappedFile> weak = mapped;
+  mapped.reset();
+  EXPECT(!weak.expired());
+  EXPECT(MappedFile::FromHandle(second)->data()[1] == 38);
+  MappedFile::Release(first);
+  EXPECT(!weak.expired());
+  MappedFile::Release(second);
+  EXPECT(weak.expired());
+}
+
+}
+
+int main() {
+  testOpen();
+  testEmpty();
+  testWritable();
+  testAdvise();
+  testRanges();
+  testHandles();
+  if (failures) {
+    fprintf(stderr, "%d failure(s)\n", failures);
+    return 1;
+  }
+  printf("test_mmap: ok\n");
+  return 0;
+}